@@ -0,0 +1,755 @@
+/**
+ * @file swi_bus.h
+ * @brief Reentrant single-wire interface (SWI) bus driver for the AT21CS01/AT21CS11.
+ *
+ * All per-bus state lives in a swi_bus_t context, so several buses (pins) can be driven
+ * from the same code. The protocol primitives are always-inline templates that take the
+ * pin and the timing profile as arguments; SWI_DEFINE_PROFILE() instantiates them for one
+ * (profile, pin) pair with compile-time constants. Every delay then folds to a fixed cycle
+ * count and every pin access to a single SIO register write, so each profile's hot loop
+ * has constant timing. The instances are placed in RAM to keep flash cache misses out
+ * of the bit timing. SWI_DEFINE_TUNED_PROFILE() instead reads the cycle counts from the
+ * bus context, so a bus can be tuned at run time (e.g. to its measured rise time).
+ *
+ * Usage:
+ *   SWI_DEFINE_PROFILE(prusa_gp2, 2, SWI_TIMING_PRUSA)
+ *   swi_bus_t bus;
+ *   swi_bus_init(&bus, &swi_profile_prusa_gp2);
+ *   uint8_t ack = swi_tx_byte(&bus, 0xA0);
+ *
+ * Author: jjsch-dev
+ */
+
+#ifndef SWI_BUS_H
+#define SWI_BUS_H
+
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#if PICO_RISCV
+#include "hardware/riscv.h"
+#elif defined(PICO2)
+#include "hardware/structs/m33.h"
+#else
+#include "hardware/structs/systick.h"
+#endif
+
+// Define ack/nack sequence
+#define SEND_ACK	0
+#define SEND_NACK	1
+
+// Bus faults, latched in swi_bus_t.fault.
+#define SWI_FAULT_NONE      0
+#define SWI_FAULT_STUCK_LOW 1   ///< The released line did not read high.
+
+// Budget for the released line to read high before a transaction starts.
+#define SWI_IDLE_HIGH_US    20
+
+/**
+ * @brief Bit timing of one speed setting, in microseconds.
+ */
+typedef struct {
+    double low1_us;     ///< Low pulse of a logic '1' (tLOW1).
+    double low0_us;     ///< Low pulse of a logic '0' (tLOW0).
+    double rd_us;       ///< Low pulse that starts a read slot (tRD).
+    double mrs_us;      ///< Release to sample delay (tMRS).
+    double bit_us;      ///< Whole bit frame (tBIT).
+    double boost_us;    ///< Active pull-up: line driven high at the start of host releases (0 = off).
+    double hold0_us;    ///< Shortest time the device holds a '0' low in a read slot (tHLD0 min).
+} swi_timing_t;
+
+// Longest active pull-up pulse. It only follows host-driven lows of written bits, where
+// the device never drives the line, and must end well inside the high part of the frame.
+#define SWI_BOOST_MAX_US    0.5
+
+// Line high time that ends one transaction and starts the next (tHTSS with margin).
+#define SWI_START_STOP_US   500
+// Shortest line high time the device takes as a start/stop condition (tHTSS min, High Speed).
+// A shorter idle time inside a transaction is not a new start.
+#define SWI_HTSS_MIN_US     150
+
+// Timing constants for different speed settings.
+// Prusa timings are used as a baseline.
+#define SWI_TIMING_PRUSA    ((swi_timing_t){ .low1_us = 2, .low0_us = 10, .rd_us = 1, .mrs_us = 1, .bit_us = 25, .boost_us = 0, .hold0_us = 2 })
+// Atmel timing constants for standard speed.
+#define SWI_TIMING_ATMEL_ST ((swi_timing_t){ .low1_us = 4, .low0_us = 24, .rd_us = 4, .mrs_us = 2, .bit_us = 45, .boost_us = 0, .hold0_us = 8 })
+// Atmel timing constants for high speed.
+#define SWI_TIMING_ATMEL_HI ((swi_timing_t){ .low1_us = 1, .low0_us = 10, .rd_us = 1, .mrs_us = 1, .bit_us = 15, .boost_us = 0, .hold0_us = 2 })
+
+/**
+ * @brief Bit timing converted to busy-wait cycle counts (delay calibration included).
+ */
+typedef struct {
+    uint32_t low1;      ///< Low part of a '1'.
+    uint32_t high1;     ///< Rest of the '1' frame.
+    uint32_t low0;      ///< Low part of a '0'.
+    uint32_t high0;     ///< Rest of the '0' frame.
+    uint32_t rd;        ///< Read slot low pulse.
+    uint32_t mrs;       ///< Release to sample.
+    uint32_t rd_rest;   ///< Rest of the read frame.
+    uint32_t boost;     ///< Active pull-up pulse, 0 when off.
+} swi_cycles_t;
+
+// Lowest values swi_bus_tune() may choose (AT21CS01/AT21CS11 high-speed minimums).
+#define SWI_TUNE_LOW1_MIN_US    1.0
+#define SWI_TUNE_LOW0_MIN_US    6.0
+#define SWI_TUNE_RD_MIN_US      1.0
+#define SWI_TUNE_MRS_MIN_US     0.25
+#define SWI_TUNE_RISE_MARGIN    1.5     ///< Sample point = margin x measured rise time + SWI_TUNE_MRS_MIN_US
+
+typedef struct swi_bus swi_bus_t;
+
+/**
+ * @brief Entry points of one (timing profile, pin) instantiation.
+ */
+typedef struct {
+    const char *name;
+    uint pin;
+    bool tuned;             ///< Timing comes from the bus context (swi_bus_tune()), not from .timing.
+    swi_timing_t timing;    ///< For code that times bits at run time (e.g. waveform programs).
+    uint8_t (*discovery)(swi_bus_t *bus);
+    uint8_t (*tx_byte)(swi_bus_t *bus, uint8_t data_byte);
+    uint8_t (*rx_byte)(swi_bus_t *bus, uint8_t ack);
+} swi_profile_t;
+
+/**
+ * @brief Bus context. One per single-wire line.
+ */
+struct swi_bus {
+    uint pin;                       ///< GPIO of the line (matches profile->pin).
+    const swi_profile_t *profile;   ///< Active timing profile.
+    uint8_t fault;                  ///< SWI_FAULT_* latched by the primitives, cleared by the caller.
+    swi_timing_t tuned_timing;      ///< Timing of tuned profiles, set by swi_bus_tune().
+    swi_cycles_t tuned_cycles;      ///< Same, in cycles.
+};
+
+// System clock the cycle counts are computed for, in kHz. The defaults are the stock clocks
+// (Pico 125 MHz, ~8 ns per cycle; Pico 2 150 MHz, ~6.67 ns per cycle). Overclocked builds
+// set it from CMake (-DSWI_SYS_CLK_KHZ=250000) and the firmware programs the PLL to match,
+// so every delay table is recomputed at compile time for the new clock.
+#ifndef SWI_SYS_CLK_KHZ
+#ifdef PICO2
+#define SWI_SYS_CLK_KHZ     150000
+#else
+#define SWI_SYS_CLK_KHZ     125000
+#endif
+#endif
+
+/**
+ * @brief Converts a duration in microseconds to CPU cycles at SWI_SYS_CLK_KHZ.
+ */
+static inline __attribute__((always_inline)) uint32_t swi_us_to_cycles(double __us) {
+    return (uint32_t)(__us * (SWI_SYS_CLK_KHZ / 1000.0));
+}
+
+/**
+ * @brief Converts CPU cycles back to microseconds (not for timing-critical code).
+ */
+static inline double swi_cycles_to_us(uint32_t cycles) {
+    return cycles / (SWI_SYS_CLK_KHZ / 1000.0);
+}
+
+/*
+ * Cycle counter and delay backend. The RP2350 has a free-running 32-bit cycle counter on
+ * both architectures (DWT CYCCNT on the Cortex-M33, mcycle on the Hazard3 RISC-V cores),
+ * so waits end at absolute deadlines: the time spent between two waits (pin writes, loop
+ * control, sampling, a stall) is absorbed by the next one instead of adding to it, and
+ * no calibration constant is needed. The RP2040 falls back to the SDK's counted loop,
+ * which counts loop iterations, minus SWI_DELAY_CAL, and times with SysTick (24 bits,
+ * counting down). All backends expose an up-counting value masked to
+ * SWI_CYCLE_COUNTER_MASK.
+ */
+#if PICO_RISCV || defined(PICO2)
+#define SWI_CYCLE_DEADLINES     1
+#define SWI_CYCLE_COUNTER_MASK  0xFFFFFFFFu
+#define SWI_DELAY_CAL   0   ///< Absorbed by the deadlines
+#else
+#define SWI_CYCLE_DEADLINES     0
+#define SWI_CYCLE_COUNTER_MASK  0x00FFFFFFu
+#define SWI_DELAY_CAL   7   ///< Cycles consumed by the delay call itself (counted loop)
+#endif
+
+/**
+ * @brief Starts the cycle counter of the calling core (each core has its own).
+ *
+ * Must run on every core that uses the delay helpers before its first delay: DWT
+ * CYCCNT and mcycle are stopped at reset, and a deadline wait on a stopped counter
+ * never ends.
+ */
+static inline void swi_cycle_counter_init(void) {
+#if PICO_RISCV
+    riscv_clear_csr(mcountinhibit, 1u);     // Let mcycle count.
+#elif defined(PICO2)
+    m33_hw->demcr |= M33_DEMCR_TRCENA_BITS;
+    m33_hw->dwt_ctrl |= M33_DWT_CTRL_CYCCNTENA_BITS;
+#else
+    if (!(systick_hw->csr & 0x1)) {
+        systick_hw->rvr = SWI_CYCLE_COUNTER_MASK;
+        systick_hw->cvr = 0;
+        systick_hw->csr = 0x5;  // Enabled, processor clock, no interrupt.
+    }
+#endif
+}
+
+/**
+ * @brief Reads the up-counting cycle counter. Differences wrap at SWI_CYCLE_COUNTER_MASK.
+ */
+static inline __attribute__((always_inline)) uint32_t swi_cycle_counter(void) {
+#if PICO_RISCV
+    return (uint32_t)riscv_read_csr(mcycle);
+#elif defined(PICO2)
+    return m33_hw->dwt_cyccnt;
+#else
+    return ~systick_hw->cvr & SWI_CYCLE_COUNTER_MASK;
+#endif
+}
+
+/**
+ * @brief Cycle count a chain of waits is measured from (see swi_deadline_wait()).
+ */
+typedef uint32_t swi_deadline_t;
+
+/**
+ * @brief Starts a chain of waits at the current cycle.
+ */
+static inline __attribute__((always_inline)) swi_deadline_t swi_deadline_start(void) {
+#if SWI_CYCLE_DEADLINES
+    return swi_cycle_counter();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Advances a deadline by the given number of cycles and waits until it is reached.
+ *
+ * Consecutive waits on the same deadline are exactly `cycles` apart, whatever runs in
+ * between. A deadline already in the past returns at once. Without a free-running counter
+ * this is a plain delay of `cycles` from now.
+ */
+static inline __attribute__((always_inline)) void swi_deadline_wait(swi_deadline_t *deadline,
+                                                                    uint32_t cycles) {
+#if SWI_CYCLE_DEADLINES
+    *deadline += cycles;
+    while ((int32_t)(swi_cycle_counter() - *deadline) < 0) {
+    }
+#else
+    (void)deadline;
+    busy_wait_at_least_cycles(cycles);
+#endif
+}
+
+/**
+ * @brief Busy-waits for at least the given number of CPU cycles.
+ */
+static inline __attribute__((always_inline)) void swi_delay_cycles(uint32_t cycles) {
+    swi_deadline_t deadline = swi_deadline_start();
+    swi_deadline_wait(&deadline, cycles);
+}
+
+/**
+ * @brief Busy-wait delay in microseconds using cycle counting.
+ *
+ * Converts the desired delay in microseconds to the equivalent number of CPU cycles,
+ * taking into account the clock speed. Always inlined: with a constant argument the
+ * whole conversion happens at compile time.
+ *
+ * Adjust the calibration constant (SWI_DELAY_CAL) as needed for your application
+ * (counted loop backend only).
+ *
+ * @param __us Delay duration in microseconds.
+ */
+static inline __attribute__((always_inline)) void soft_delay_us(double __us) {
+    uint32_t __count = swi_us_to_cycles(__us) - SWI_DELAY_CAL;
+    swi_delay_cycles(__count);
+}
+
+/**
+ * @brief Converts a bit timing to delay cycle counts. Folds to constants for constant timings.
+ */
+static inline __attribute__((always_inline)) swi_cycles_t swi_timing_cycles(swi_timing_t t) {
+    return (swi_cycles_t){
+        .low1 = swi_us_to_cycles(t.low1_us) - SWI_DELAY_CAL,
+        .high1 = swi_us_to_cycles(t.bit_us - t.low1_us - t.boost_us) - SWI_DELAY_CAL,
+        .low0 = swi_us_to_cycles(t.low0_us) - SWI_DELAY_CAL,
+        .high0 = swi_us_to_cycles(t.bit_us - t.low0_us - t.boost_us) - SWI_DELAY_CAL,
+        .rd = swi_us_to_cycles(t.rd_us) - SWI_DELAY_CAL,
+        .mrs = swi_us_to_cycles(t.mrs_us) - SWI_DELAY_CAL,
+        .rd_rest = swi_us_to_cycles(t.bit_us - t.rd_us - t.mrs_us) - SWI_DELAY_CAL,
+        .boost = (t.boost_us > 0) ? swi_us_to_cycles(t.boost_us) : 0,
+    };
+}
+
+/**
+ * @brief Checks a timing against the rules the primitives rely on.
+ *
+ * @return NULL if the timing is usable, otherwise an error message.
+ */
+static inline const char *swi_timing_check(const swi_timing_t *t) {
+    if (t->boost_us < 0 || t->boost_us > SWI_BOOST_MAX_US) {
+        return "Pull-up assist too long";
+    }
+    if (t->low0_us + t->boost_us >= t->bit_us || t->rd_us + t->mrs_us >= t->bit_us) {
+        return "Bit frame too short";
+    }
+    // A later sample would read the line after the device has released a '0'.
+    if (t->rd_us + t->mrs_us > t->hold0_us) {
+        return "Read sample after the device hold time";
+    }
+    // Every delay must outlast the call overhead, or its cycle count wraps around.
+    double shortest = MIN(MIN(t->low1_us, t->low0_us), MIN(t->rd_us, t->mrs_us));
+    shortest = MIN(shortest, t->bit_us - t->low0_us - t->boost_us);
+    shortest = MIN(shortest, t->bit_us - t->rd_us - t->mrs_us);
+    if (swi_us_to_cycles(shortest) <= SWI_DELAY_CAL) {
+        return "Delay below the call overhead at this clock";
+    }
+    return NULL;
+}
+
+/**
+ * @brief Releases the line so that the pull-up resistor can pull it high.
+ */
+static inline __attribute__((always_inline)) void swi_set_high(uint pin) {
+    gpio_set_dir(pin, GPIO_IN);
+}
+
+/**
+ * @brief Drives the line low. The output register is preset to 0 by swi_bus_init().
+ */
+static inline __attribute__((always_inline)) void swi_set_low(uint pin) {
+    gpio_set_dir(pin, GPIO_OUT);
+}
+
+/**
+ * @brief Ends the low part of a written bit, optionally with the active pull-up.
+ *
+ * With a boost the pin is switched from driving low to driving high (push-pull) for
+ * `boost` cycles of the bit's deadline chain, then released. Only used after
+ * host-driven lows of written bits: read slots, ACK slots and discovery always
+ * release plainly, because the device may be driving the line low right after them.
+ */
+static inline __attribute__((always_inline)) void swi_release_tx(uint pin, uint32_t boost,
+                                                                 swi_deadline_t *deadline) {
+    if (boost) {
+        gpio_put(pin, 1);
+        swi_deadline_wait(deadline, boost);
+        gpio_set_dir(pin, GPIO_IN);
+        gpio_put(pin, 0);   // Output register back to 0 for swi_set_low().
+    } else {
+        swi_set_high(pin);
+    }
+}
+
+/**
+ * @brief Releases the line and returns its logic level (0 = low, 1 = high).
+ */
+static inline __attribute__((always_inline)) uint8_t swi_get_value(uint pin) {
+    gpio_set_dir(pin, GPIO_IN);
+    return gpio_get(pin);
+}
+
+/**
+ * @brief Releases the line and waits, within a budget, for it to read high.
+ *
+ * @return false if the line is still low after budget_us (held low by a fault).
+ */
+static inline __attribute__((always_inline)) bool swi_line_released(uint pin, double budget_us) {
+    swi_set_high(pin);
+    for (uint32_t i = swi_us_to_cycles(budget_us) / 16; i > 0; i--) {
+        if (gpio_get(pin)) {
+            return true;
+        }
+        swi_delay_cycles(8);
+    }
+    return gpio_get(pin);
+}
+
+/**
+ * @brief Performs the EEPROM discovery response sequence.
+ *
+ * Fails at once, without the reset pulse, if the line is not high to start with.
+ *
+ * @return 0x00 if ACK is observed, or 0xFF if NACK is detected.
+ */
+static inline __attribute__((always_inline)) uint8_t swi_discovery_impl(uint pin, uint8_t *fault) {
+    uint8_t temp;
+
+    if (!swi_line_released(pin, SWI_IDLE_HIGH_US)) {
+        *fault = SWI_FAULT_STUCK_LOW;
+        return 0xFF;
+    }
+    soft_delay_us(200);  // tHTSS (Standard Speed)
+    swi_set_low(pin);
+    soft_delay_us(150); //(500);  // tRESET (Standard Speed)
+    swi_set_high(pin);
+    soft_delay_us(100); //(20);   // tRRT
+
+    swi_set_low(pin);
+    soft_delay_us(1); // tDRR
+    swi_set_high(pin);
+    soft_delay_us(3); //(2);    // tMSDR
+    temp = (swi_get_value(pin) == 0) ? 0x00 : 0xFF;
+    soft_delay_us(150); //(21);   // tDACK delay
+    return temp;
+}
+
+/**
+ * @brief Transmits a logic '1' bit.
+ *
+ * The bit primitives take the deadline chain of their byte, so every edge is placed
+ * relative to the first one (see swi_deadline_wait()).
+ */
+static inline __attribute__((always_inline)) void swi_tx_one_impl(uint pin, swi_cycles_t c,
+                                                                  swi_deadline_t *deadline) {
+    swi_set_low(pin);
+    swi_deadline_wait(deadline, c.low1);
+    swi_release_tx(pin, c.boost, deadline);
+    swi_deadline_wait(deadline, c.high1);
+}
+
+/**
+ * @brief Transmits a logic '0' bit.
+ */
+static inline __attribute__((always_inline)) void swi_tx_zero_impl(uint pin, swi_cycles_t c,
+                                                                   swi_deadline_t *deadline) {
+    swi_set_low(pin);
+    swi_deadline_wait(deadline, c.low0);
+    swi_release_tx(pin, c.boost, deadline);
+    swi_deadline_wait(deadline, c.high0);
+}
+
+/**
+ * @brief Reads a single bit from the bus.
+ *
+ * @return The read bit (0 or 1).
+ */
+static inline __attribute__((always_inline)) uint8_t swi_read_bit_impl(uint pin, swi_cycles_t c,
+                                                                       swi_deadline_t *deadline) {
+    swi_set_low(pin);
+    swi_deadline_wait(deadline, c.rd);         // Read delay period.
+    swi_set_high(pin);
+    swi_deadline_wait(deadline, c.mrs);        // Minimum recovery time.
+    uint8_t temp = swi_get_value(pin) & 0x01;
+    swi_deadline_wait(deadline, c.rd_rest);
+    swi_set_high(pin);
+    return temp;
+}
+
+/**
+ * @brief Transmits a byte MSB first and then reads the ACK/NACK bit.
+ *
+ * Each bit frame ends with the line released, so a low level at the start of
+ * the next frame means the line is held low: the byte is abandoned there.
+ *
+ * @return 0x00 on ACK, 0xFF on NACK or fault.
+ */
+static inline __attribute__((always_inline)) uint8_t swi_tx_byte_impl(uint pin, swi_cycles_t t,
+                                                                      uint8_t data_byte, uint8_t *fault) {
+    swi_deadline_t deadline = swi_deadline_start();
+
+    for (uint8_t ii = 0; ii < 8; ii++) {
+        if (!gpio_get(pin)) {
+            *fault = SWI_FAULT_STUCK_LOW;
+            return 0xFF;
+        }
+        if (data_byte & 0x80) {
+            swi_tx_one_impl(pin, t, &deadline);
+        } else {
+            swi_tx_zero_impl(pin, t, &deadline);
+        }
+        data_byte <<= 1;
+    }
+    return swi_read_bit_impl(pin, t, &deadline) ? 0xFF : 0x00;
+}
+
+/**
+ * @brief Receives a byte MSB first and answers with ACK (SEND_ACK) or NACK (SEND_NACK).
+ *
+ * Stops early, like swi_tx_byte_impl(), if the line is low at the start of a bit frame.
+ *
+ * @return The byte received from the bus.
+ */
+static inline __attribute__((always_inline)) uint8_t swi_rx_byte_impl(uint pin, swi_cycles_t t,
+                                                                      uint8_t ack, uint8_t *fault) {
+    uint8_t data_byte = 0;
+    swi_deadline_t deadline = swi_deadline_start();
+
+    for (int8_t ii = 0; ii < 8; ii++) {
+        if (!gpio_get(pin)) {
+            *fault = SWI_FAULT_STUCK_LOW;
+            return 0xFF;
+        }
+        data_byte = (data_byte << 1) | swi_read_bit_impl(pin, t, &deadline);
+    }
+
+    if (ack) {
+        swi_tx_one_impl(pin, t, &deadline);
+    } else {
+        swi_tx_zero_impl(pin, t, &deadline);
+    }
+    return data_byte;
+}
+
+/**
+ * @brief Instantiates the protocol primitives for one timing profile and pin.
+ *
+ * Defines the RAM-resident functions swi_<id>_discovery/_tx_byte/_rx_byte and the
+ * swi_profile_<id> table that points at them.
+ *
+ * @param id     Identifier suffix, also used as the profile's printable name.
+ * @param PIN    GPIO of the line (compile-time constant).
+ * @param TIMING A swi_timing_t constant such as SWI_TIMING_PRUSA.
+ */
+#define SWI_DEFINE_PROFILE(id, PIN, TIMING)                                                   \
+    static uint8_t __not_in_flash_func(swi_##id##_discovery)(swi_bus_t *bus) {                \
+        return swi_discovery_impl(PIN, &bus->fault);                                            \
+    }                                                                                           \
+    static uint8_t __not_in_flash_func(swi_##id##_tx_byte)(swi_bus_t *bus,                    \
+                                                             uint8_t data_byte) {               \
+        return swi_tx_byte_impl(PIN, swi_timing_cycles(TIMING), data_byte, &bus->fault);        \
+    }                                                                                           \
+    static uint8_t __not_in_flash_func(swi_##id##_rx_byte)(swi_bus_t *bus,                    \
+                                                             uint8_t ack) {                     \
+        return swi_rx_byte_impl(PIN, swi_timing_cycles(TIMING), ack, &bus->fault);              \
+    }                                                                                           \
+    static const swi_profile_t swi_profile_##id = {                                           \
+        .name = #id,                                                                          \
+        .pin = PIN,                                                                             \
+        .tuned = false,                                                                         \
+        .timing = TIMING,                                                                       \
+        .discovery = swi_##id##_discovery,                                                    \
+        .tx_byte = swi_##id##_tx_byte,                                                        \
+        .rx_byte = swi_##id##_rx_byte,                                                        \
+    }
+
+/**
+ * @brief Instantiates the protocol primitives for one pin with the bit timing taken at
+ *        run time from the bus context (see swi_bus_tune()).
+ *
+ * The cycle counts are loaded once per byte, so the bit loop costs the same as a
+ * constant profile apart from a few register moves.
+ *
+ * @param id   Identifier suffix, also used as the profile's printable name.
+ * @param PIN  GPIO of the line (compile-time constant).
+ * @param BASE swi_timing_t the bus starts with until it is tuned.
+ */
+#define SWI_DEFINE_TUNED_PROFILE(id, PIN, BASE)                                                 \
+    static uint8_t __not_in_flash_func(swi_##id##_discovery)(swi_bus_t *bus) {                \
+        return swi_discovery_impl(PIN, &bus->fault);                                            \
+    }                                                                                           \
+    static uint8_t __not_in_flash_func(swi_##id##_tx_byte)(swi_bus_t *bus,                    \
+                                                             uint8_t data_byte) {               \
+        return swi_tx_byte_impl(PIN, bus->tuned_cycles, data_byte, &bus->fault);               \
+    }                                                                                           \
+    static uint8_t __not_in_flash_func(swi_##id##_rx_byte)(swi_bus_t *bus,                    \
+                                                             uint8_t ack) {                     \
+        return swi_rx_byte_impl(PIN, bus->tuned_cycles, ack, &bus->fault);                     \
+    }                                                                                           \
+    static const swi_profile_t swi_profile_##id = {                                           \
+        .name = #id,                                                                          \
+        .pin = PIN,                                                                             \
+        .tuned = true,                                                                          \
+        .timing = BASE,                                                                         \
+        .discovery = swi_##id##_discovery,                                                    \
+        .tx_byte = swi_##id##_tx_byte,                                                        \
+        .rx_byte = swi_##id##_rx_byte,                                                        \
+    }
+
+/**
+ * @brief Initializes a bus context and its pin for open-drain operation.
+ *
+ * Configures the pin as an input with an internal pull-up and sets the drive strength.
+ * The output register is set to 0 so that switching to output immediately drives the line low.
+ */
+static inline void swi_bus_init(swi_bus_t *bus, const swi_profile_t *profile) {
+    bus->pin = profile->pin;
+    bus->profile = profile;
+    bus->fault = SWI_FAULT_NONE;
+    bus->tuned_timing = profile->timing;
+    bus->tuned_cycles = swi_timing_cycles(profile->timing);
+    swi_cycle_counter_init();
+
+    gpio_init(bus->pin);
+    gpio_set_drive_strength(bus->pin, GPIO_DRIVE_STRENGTH_12MA);
+    gpio_set_dir(bus->pin, GPIO_IN);
+    gpio_pull_up(bus->pin);
+    gpio_put(bus->pin, 0);
+}
+
+/**
+ * @brief Switches the bus to another timing profile.
+ *
+ * @return false if the profile was instantiated for a different pin.
+ */
+static inline bool swi_bus_set_profile(swi_bus_t *bus, const swi_profile_t *profile) {
+    if (profile->pin != bus->pin) {
+        return false;
+    }
+    bus->profile = profile;
+    return true;
+}
+
+/**
+ * @brief Returns the bit timing in use: the tuned one for tuned profiles.
+ */
+static inline const swi_timing_t *swi_bus_timing(const swi_bus_t *bus) {
+    return bus->profile->tuned ? &bus->tuned_timing : &bus->profile->timing;
+}
+
+/**
+ * @brief Sets the timing used by tuned profiles on this bus (not timing-critical).
+ */
+static inline void swi_bus_tune(swi_bus_t *bus, const swi_timing_t *timing) {
+    bus->tuned_timing = *timing;
+    bus->tuned_cycles = swi_timing_cycles(*timing);
+}
+
+/**
+ * @brief Derives a timing from a base timing and the measured rise time of the line.
+ *
+ * The read sample point moves to the earliest moment a released line is safely high
+ * (SWI_TUNE_RISE_MARGIN times the rise time, plus SWI_TUNE_MRS_MIN_US). The low pulses
+ * are shortened by the rise time, which the device sees as extra low time, down to the
+ * datasheet minimums. The bit frame is unchanged. The sample point is capped at the
+ * device hold time (hold0_us); a line that rises slower than that cannot be read
+ * reliably, so callers still run swi_timing_check() on the result.
+ */
+static inline swi_timing_t swi_timing_for_rise(const swi_timing_t *base, double rise_us) {
+    swi_timing_t t = *base;
+    t.low1_us = MAX(base->low1_us - rise_us, SWI_TUNE_LOW1_MIN_US);
+    t.low0_us = MAX(base->low0_us - rise_us, SWI_TUNE_LOW0_MIN_US);
+    t.rd_us = MAX(base->rd_us - rise_us, SWI_TUNE_RD_MIN_US);
+    t.mrs_us = MIN(rise_us * SWI_TUNE_RISE_MARGIN + SWI_TUNE_MRS_MIN_US, base->hold0_us - t.rd_us);
+    return t;
+}
+
+/**
+ * @brief Measures the rise time of the line (run with interrupts disabled).
+ *
+ * Drives the line low, releases it and counts CPU cycles with the cycle counter
+ * (started by swi_bus_init()) until it reads high.
+ *
+ * @param budget_us Longest rise accepted.
+ * @return Cycles from release to the first high reading, or 0 if the line stayed low.
+ */
+static inline uint32_t swi_measure_rise(const swi_bus_t *bus, double budget_us) {
+    const uint32_t budget = swi_us_to_cycles(budget_us);
+    const uint pin = bus->pin;
+    uint32_t elapsed;
+
+    swi_set_low(pin);
+    soft_delay_us(5);
+    uint32_t start = swi_cycle_counter();
+    swi_set_high(pin);
+    do {
+        elapsed = (swi_cycle_counter() - start) & SWI_CYCLE_COUNTER_MASK;
+        if (gpio_get(pin)) {
+            return MAX(elapsed, 1u);
+        }
+    } while (elapsed < budget);
+    return 0;
+}
+
+/**
+ * @brief Performs the discovery response sequence. @return 0x00 on ACK, 0xFF on NACK.
+ */
+static inline uint8_t swi_discovery(swi_bus_t *bus) {
+    return bus->profile->discovery(bus);
+}
+
+/**
+ * @brief Transmits a byte. @return 0x00 on ACK, 0xFF on NACK.
+ */
+static inline uint8_t swi_tx_byte(swi_bus_t *bus, uint8_t data_byte) {
+    return bus->profile->tx_byte(bus, data_byte);
+}
+
+/**
+ * @brief Receives a byte, then sends ACK (SEND_ACK) or NACK (SEND_NACK). @return The byte.
+ */
+static inline uint8_t swi_rx_byte(swi_bus_t *bus, uint8_t ack) {
+    return bus->profile->rx_byte(bus, ack);
+}
+
+/**
+ * @brief Reads a block in a single sequential transaction, with explicit gaps.
+ *
+ * A dummy write loads the address pointer, then one read opcode is followed by
+ * len bytes, each ACKed except the last. This costs 9 bit frames per byte instead
+ * of the four transactions per byte of random reads.
+ *
+ * @param opcode    Memory opcode with the device address (R/W bit clear).
+ * @param data_addr First address to read.
+ * @param buf       Destination, len bytes.
+ * @param addr_gap  Cycles of idle line between the address load and the read opcode.
+ * @param byte_gap  Extra idle cycles between consecutive data bytes.
+ * @return 0x00 on success, 0xFF if the device did not acknowledge.
+ */
+static inline uint8_t swi_read_seq_gaps(swi_bus_t *bus, uint8_t opcode, uint8_t data_addr,
+                                        uint8_t *buf, uint16_t len, uint32_t addr_gap,
+                                        uint32_t byte_gap) {
+    if (swi_tx_byte(bus, opcode) || swi_tx_byte(bus, data_addr)) {
+        return 0xFF;
+    }
+    swi_delay_cycles(addr_gap);
+    if (swi_tx_byte(bus, opcode | 0x01)) {
+        return 0xFF;
+    }
+    for (uint16_t i = 0; i < len && !bus->fault; i++) {
+        if (i > 0) {
+            swi_delay_cycles(byte_gap);
+        }
+        buf[i] = swi_rx_byte(bus, (i + 1 < len) ? SEND_ACK : SEND_NACK);
+    }
+    soft_delay_us(SWI_START_STOP_US);
+    return bus->fault ? 0xFF : 0x00;
+}
+
+/**
+ * @brief Reads a block in a single sequential transaction with the default gaps.
+ *
+ * @return 0x00 on success, 0xFF if the device did not acknowledge.
+ */
+static inline uint8_t swi_read_seq(swi_bus_t *bus, uint8_t opcode, uint8_t data_addr,
+                                   uint8_t *buf, uint16_t len) {
+    return swi_read_seq_gaps(bus, opcode, data_addr, buf, len,
+                             swi_us_to_cycles(SWI_START_STOP_US), 0);
+}
+
+/**
+ * @brief Writes up to one page in a single transaction and ends it with a stop condition.
+ *
+ * The caller keeps the data inside one page; the device wraps within the page otherwise.
+ *
+ * @return 0x00 on success, 0xFF if the device did not acknowledge a byte.
+ */
+static inline uint8_t swi_write_page(swi_bus_t *bus, uint8_t opcode, uint8_t data_addr,
+                                     const uint8_t *buf, uint16_t len) {
+    uint8_t ack = swi_tx_byte(bus, opcode);
+    if (!ack) {
+        ack = swi_tx_byte(bus, data_addr);
+    }
+    for (uint16_t i = 0; i < len && !ack; i++) {
+        ack = swi_tx_byte(bus, buf[i]);
+    }
+    soft_delay_us(SWI_START_STOP_US);  // The stop condition starts the internal write cycle.
+    return ack;
+}
+
+/**
+ * @brief Acknowledge polling: addresses the device until it ACKs (internal write done).
+ *
+ * @param max_polls Attempts before giving up.
+ * @return true once the device acknowledged, false on timeout.
+ */
+static inline bool swi_ack_poll(swi_bus_t *bus, uint8_t opcode, uint32_t max_polls) {
+    for (uint32_t i = 0; i < max_polls && !bus->fault; i++) {
+        uint8_t ack = swi_tx_byte(bus, opcode);
+        soft_delay_us(SWI_START_STOP_US);
+        if (!ack) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif /* SWI_BUS_H */
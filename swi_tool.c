@@ -32,18 +32,206 @@
  * - readBlock
  *     - Command: {"command": "readBlock", "dev_addr": "0x00", "start_addr": "0x00", "len": "0x10"}
  *       (The "dev_addr", "start_addr", and "len" fields specify the device address, the starting EEPROM address,
- *       and the number of bytes to read, respectively. All values are given as hexadecimal strings.)
+ *       and the number of bytes to read, respectively. All values are given as hexadecimal strings.
+ *       The array size comes from the manufacturer ID (eeprom_table); without "len" the block runs to
+ *       the end of the array, and ranges outside it fail before any data is read.)
  *     - Expected Response: {"status":"success","command":"readBlock","response":["0xXX", "0xXX", ...]}
  *       (A JSON array of hexadecimal strings representing the block data.)
  *
+ * - runWaveform
+ *     - Command: {"command": "runWaveform", "program": "010000FA 020000FA 04800064 03000000"}
+ *       (Hexadecimal instruction words of the Core1 waveform bytecode, see WF_OP_*. Precompiled
+ *       by the host and executed on Core1 with interrupts disabled. Programs whose worst-case run
+ *       time, with loops unrolled and WAIT_UNTIL at its timeout, exceeds WF_MAX_DURATION_US are
+ *       rejected with "Program too long".)
+ *     - Expected Response: {"status":"success","command":"runWaveform","response":{"result":"OK",
+ *       "samples":"1","timeouts":0}}
+ *
+ * - macroBegin / macroEnd / macroList / macroDelete / run
+ *     - {"command": "macroBegin", "name": "prodtest"} starts recording: the following command lines
+ *       are stored (each answered with {"status":"success","command":"macroRecord","response":"<command>"})
+ *       until {"command": "macroEnd"} writes the macro to its own flash sector.
+ *     - {"command": "macroList"} -> {"status":"success","command":"macroList","response":[{"name":"prodtest","bytes":N}]}
+ *     - {"command": "macroDelete", "name": "prodtest"}
+ *     - {"command": "run", "name": "prodtest"} executes the stored commands, streaming each response,
+ *       then answers {"status":"success","command":"run","response":{"name":"prodtest","commands":N}}.
+ *
+ * - Scheduled execution (any command, including "run")
+ *     - Command: {"command": "readBlock", ..., "at_us": 12000000, "period_us": 5000, "count": 10}
+ *       ("at_us" is the device time (time_us_64) of the first run, "period_us" the interval and
+ *       "count" the number of runs. Core1 starts the first bus transaction of each run on time.)
+ *     - Each result is followed by: {"status":"success","command":"schedule","response":{"index":N,
+ *       "at_us":N,"start_us":N,"late_us":N}}
+ *
+ * - setSpeed
+ *     - Command: {"command": "setSpeed", "data": "high"}
+ *       (Selects the bit timing used by the tool: "prusa" (default), "standard", "high" or "tuned".
+ *       It does not send the speed opcodes to the device.)
+ *     - Expected Response: {"status": "success", "command": "setSpeed", "response": "high"}
+ *
+ * - measureRise
+ *     - Command: {"command": "measureRise", "count": 32, "data": "apply"}
+ *       (Times the release-to-high transition of the line on Core1 "count" times. The worst rise
+ *       time gives the earliest safe sample point and the shortest low pulses; with "apply" they
+ *       become the "tuned" speed profile of the bus. The sample point must stay within the device
+ *       hold time of a '0' (hold0_us); a slower line is rejected with an error instead of applied.)
+ *     - Expected Response: {"status":"success","command":"measureRise","response":{"samples":32,"timeouts":0,
+ *       "rise_ns_min":N,"rise_ns_avg":N,"rise_ns_max":N,"base":"prusa","timing_ns":{"low1":N,"low0":N,
+ *       "rd":N,"mrs":N,"bit":N},"applied":true}}
+ *
+ * - setPullupAssist
+ *     - Command: {"command": "setPullupAssist", "data": "0xC8"}
+ *       (Drives the line high (push-pull) for "data" ns, hexadecimal, at the start of the release
+ *       phase of every written bit, before switching to input, for faster rising edges. Never used
+ *       in read, ACK or discovery slots, where the device may drive the line low. Applied through
+ *       the "tuned" profile; "0x00" turns it off. Limited to SWI_BOOST_MAX_US.)
+ *     - Expected Response: {"status":"success","command":"setPullupAssist","response":{"boost_ns":200,
+ *       "profile":"tuned","base":"prusa"}}
+ *
+ * - setEcho
+ *     - Command: {"command": "setEcho", "data": "0x00"}
+ *       ("0x00" disables the echo of received characters, any other value enables it.
+ *       Echo is on by default for terminal users; machine clients should turn it off.)
+ *     - Expected Response: {"status": "success", "command": "setEcho", "response": "OFF"}
+ *
+ * - setTrace
+ *     - Command: {"command": "setTrace", "data": "0x01"}
+ *       (Any non-zero value reports every Core1 transaction on the event channel, "0x00" stops it.)
+ *     - Expected Response: {"status": "success", "command": "setTrace", "response": "ON"}
+ *
+ * - stats
+ *     - Command: {"command": "stats"}
+ *     - Expected Response: {"status":"success","command":"stats","response":{"commands":N,"busy_rejects":N,
+ *       "tx_queue_size":N,"tx_queue_used":N,"tx_queue_high_water":N,"tx_overflows":N,
+ *       "evt_queue_high_water":N,"evt_drops":N,"latency_last_us":N,"latency_max_us":N,"bus_faults":N,
+ *       "core1_timeouts":N,"cancels":N,"lanes":{"control":{"commands":N,"wait_last_us":N,"wait_max_us":N},
+ *       "bus":{"commands":N,"wait_last_us":N,"wait_max_us":N}}}}
+ *       (wait_*_us: queueing delay per lane, from the line's arrival to the start of its execution.)
+ *
+ * - clockInfo
+ *     - Command: {"command": "clockInfo"}
+ *     - Expected Response: {"status":"success","command":"clockInfo","response":{"sys_khz":250000,
+ *       "measured_khz":250012,"ns_per_cycle":4.000,"timing_valid":true}}
+ *       (Measures clk_sys and rechecks every timing profile against it.)
+ *
+ * - benchmark
+ *     - Command: {"command": "benchmark"}
+ *     - Expected Response: {"status":"success","command":"benchmark","response":{"arch":"hazard3",
+ *       "sys_khz":150000,"delay_cal":5,"delay_ns":{"nominal":10000,"min":10006,"avg":10013,"max":10026},
+ *       "frame":{"profile":"prusa","nominal_ns":25000,"avg_ns":25040,"bits_per_s":39936}}}
+ *       (Times the delay primitive and BENCH_FRAMES bit frames of the active profile on Core1, with
+ *       the core's cycle counter and the line left released. arch: cortex-m0plus, cortex-m33 or
+ *       hazard3, the RISC-V build for the RP2350.)
+ *
+ * - ping
+ *     - Command: {"command": "ping"}
+ *     - Expected Response: {"status":"success","command":"ping","response":"pong"}
+ *
+ * - Command lanes
+ *     - ping, stats, sync, setTrace and cancel are control commands: they are answered at once,
+ *       even while a bus command is running (setTrace waits for it to finish). All other
+ *       commands (and any scheduled command) are bus commands, queued (up to 4) and run one
+ *       at a time in arrival order.
+ *
+ * - watch
+ *     - Command: {"command": "watch", "dev_addr": "0x00", "start_addr": "0x00", "len": "0x80", "interval_us": 50000}
+ *       (Re-reads the region in the background with one sequential read per scan, default every
+ *       100 ms, and reports each changed byte on the event channel:
+ *       {"event":"watch","t_us":N,"addr":"0x10","old":"0xFF","new":"0x5A"}.)
+ *     - Expected Response: {"status":"success","command":"watch","response":{"active":true,"interval_us":50000}}
+ *     - {"command": "watch", "data": "stop"} cancels it.
+ *
+ * - memtest
+ *     - Command: {"command": "memtest", "dev_addr": "0x00", "data": "all"}
+ *       ("data" selects one pattern: walking1, walking0, checker, checker_inv, address, prbs, or all.
+ *       Each pattern is generated on the device, written with page writes and read back sequentially.)
+ *     - Expected Response, one line per pattern and a summary:
+ *       {"status":"success","command":"memtest","response":{"pattern":"walking1","fails":[
+ *       {"addr":"0x12","exp":"0x04","got":"0x00","mask":"0x04"}],"errors":1}}
+ *       {"status":"error","command":"memtest","response":{"patterns":6,"failed":1}}
+ *
+ * - soak
+ *     - Command: {"command": "soak", "dev_addr": "0x00", "data": "0x000F", "count": 100000}
+ *       (Endurance test in the background: every cycle writes the pages selected by the "data"
+ *       mask with the next memtest pattern and verifies them. "count" 0 runs until stopped.
+ *       Progress, the first failure and completion are reported on the event channel.)
+ *     - {"command": "soak", "data": "status"} / {"command": "soak", "data": "stop"} ->
+ *       {"status":"success","command":"soak","response":{"active":false,"cycles":N,"writes":N,"fails":N,
+ *       "first_fail_cycle":N,"elapsed_us":N,"write_us_min":N,"write_us_max":N,"hist_edges_us":[..],"hist":[..]}}
+ *
+ * - gapProbe
+ *     - Command: {"command": "gapProbe", "dev_addr": "0x00", "start_addr": "0x00", "len": "0x10"}
+ *       (Reads the block sequentially with the largest candidate gaps as a reference, then shrinks
+ *       the idle time between data bytes (byte_gap_candidates_us[]), and between the address load
+ *       and the read (addr_gap_candidates_us[], floored at tHTSS so the probe never writes).
+ *       Reports the smallest gap at which GAP_TRIES reads all ACKed and matched, -1 if none.)
+ *     - Expected Response: {"status":"success","command":"gapProbe","response":{"byte_gap_us":0,
+ *       "addr_gap_us":150,"tries":3}}
+ *
+ * - romZoneRead / romZoneSet / romFreeze / romZoneVerify
+ *     - {"command": "romZoneRead", "dev_addr": "0x00"} reads the four ROM zone registers in one Core1
+ *       dispatch: {"status":"success","command":"romZoneRead","response":["0x00", "0xFF", "0x00", "0x00"]}
+ *     - {"command": "romZoneSet", "dev_addr": "0x00", "data": "0x02", "confirm": "confirm"} sets the zones
+ *       in the mask to ROM (permanent; rejected without "confirm") and answers with the registers read back.
+ *     - {"command": "romFreeze", "dev_addr": "0x00", "data": "confirm"} freezes the zone registers (permanent).
+ *     - {"command": "romZoneVerify", "dev_addr": "0x00"} checks on the device that writes to ROM zones are
+ *       NACKed and leave the data intact, and that writable zones accept writes:
+ *       {"status":"success","command":"romZoneVerify","response":{"pass":true,"zones":[{"zone":0,"rom":false,
+ *       "nack":false,"intact":true,"pass":true},...]}}
+ *
+ * - cancel
+ *     - Command: {"command": "cancel"}, or the single control byte 0x18 (CAN) at any time.
+ *       (Seen as soon as it arrives, even while a command runs: the running command stops at
+ *       the next bus transaction and answers with status "cancelled" and its partial result;
+ *       schedules, macros, watch and soak are stopped.)
+ *     - Expected Response: {"status":"success","command":"cancel","response":{"command":true,
+ *       "watch":false,"soak":false,"dropped":0}} (what was stopped, and queued commands dropped).
+ *
+ * - sync
+ *     - Command: {"command": "sync"}
+ *     - Expected Response: {"t_us":N,"status":"success","command":"sync","response":{"t_us":N}}
+ *       (Device time in microseconds since boot, sampled and sent with minimal latency so the
+ *       host can estimate clock offset and drift. BIN_OP_SYNC is the lowest-latency variant.)
+ *
+ * Every console response line starts with the device time it was produced at ("t_us", the
+ * monotonic time_us_64() in microseconds since boot).
+ *
+ * Bus commands answer {"status":"error","command":"<command>","response":"bus_stuck_low"} when the line
+ * is held low (checked before every transaction and every bit frame), and "core1_timeout" if Core1
+ * did not answer within CORE1_TIMEOUT_US (it is then restarted).
+ *
+ * When the output queue cannot hold a full response, any command is answered with
+ * {"status":"error","command":"busy","response":"Output queue full"} and is not executed.
+ *
  * Implementation Details:
  * - EEPROM emulation is implemented using open-drain GPIO by dynamically switching the pin
  *   between input mode (to let the pull-up resistor drive it high) and output mode (to drive it low).
- * - Timing is achieved using a blocking delay function (soft_delay_us) that employs cycle counting,
- *   assuming a 125 MHz clock (approximately 8 ns per cycle). Global timing variables (time_bit, time_rd, etc.)
- *   are used for precise bit-banging and can be updated via the "setSpeed" command.
+ * - The bus protocol lives in swi_bus.h: a reentrant driver whose primitives are specialized at
+ *   compile time for each timing profile and pin (SWI_DEFINE_PROFILE), so every delay is a constant
+ *   cycle count. Timing uses a blocking delay function (soft_delay_us) that employs cycle counting
+ *   at SWI_SYS_CLK_KHZ (125 MHz / 8 ns per cycle by default, 150 MHz on the Pico 2). Overclocked
+ *   builds set SWI_SYS_CLK_KHZ; main() programs the PLL and clock_check() verifies the tables.
+ *   On the RP2350 (Cortex-M33 DWT CYCCNT, or mcycle in RISC-V builds with PICO_PLATFORM=rp2350-riscv)
+ *   the waits end at absolute cycle deadlines, chained across each byte, so loop overhead and the
+ *   code between edges do not stretch the bits; the RP2040 keeps the counted loop minus a
+ *   calibration constant (SWI_DELAY_CAL). "benchmark" compares the backends.
+ *   Core1 owns the bus context; the active profile can be changed via the "setSpeed" command.
  * - Inter-core communication uses the FIFO interface: Core0 issues commands (using send_cmd())
- *   and Core1 processes them in a blocking fashion.
+ *   and Core1 processes them in a blocking fashion. Core1 results raise the SIO FIFO interrupt
+ *   on Core0, which sleeps in __wfe() between USB, doorbell and heartbeat timer events.
+ * - Core0 drives TinyUSB directly: received bytes are drained from the CDC FIFO in bulk into a
+ *   ring buffer that is scanned for line terminators, instead of one getchar() call per character.
+ *   printf() output is routed to the same CDC interface through a custom stdio driver.
+ * - Output never blocks Core0: printf() appends to a bounded output queue that usb_service()
+ *   drains into the CDC endpoint, also while waiting for Core1. When the queue cannot hold a
+ *   full response, new commands are rejected with a "busy" error.
+ * - A second, vendor-specific bulk interface carries a compact binary protocol for host tooling
+ *   (see the BIN_OP_* opcodes). BIN_OP_LOOPBACK echoes its payload without touching the bus, so
+ *   host-side framing and throughput can be tested without an emulator attached.
+ * - A second CDC interface is reserved for asynchronous streams (traces, events), one JSON object
+ *   per line, e.g. {"event":"trace","t_us":N,"op":"TX_BYTE","data":"0x55","result":"0x00","dur_us":N,
+ *   "core1_ns":N}.
+ *   It has its own queue, so bulk diagnostics never delay command responses on the console.
  *
  * Author: jjsch-dev
  * Date: 2025-04-10
@@ -54,289 +242,410 @@
 #include "pico/time.h"
 #include "hardware/gpio.h"
 #include "hardware/sync.h"
+#include "hardware/irq.h"
+#if !PICO_RISCV
+#include "hardware/structs/scb.h"
+#endif
+#include "hardware/flash.h"
+#include "hardware/clocks.h"
+#include "hardware/vreg.h"
 #include "pico/multicore.h"
+#include "pico/stdio/driver.h"
+#include "tusb.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include "jsmn.h"  // Ensure jsmn.h is in your include path
+#include "swi_bus.h"
 
-#define BUFFER_SIZE     256
+#define BUFFER_SIZE     768 ///< Maximum length of a JSON command line (fits a full waveform program)
+#define EEPROM_MAX_SIZE 128 ///< Largest array in eeprom_table, sizes block_buffer
+#define EEPROM_PAGE_SIZE 8  ///< Largest write page in eeprom_table
+#define RX_RING_SIZE    512 ///< Bulk CDC receive ring (must be a power of two)
+#define RX_RING_MASK    (RX_RING_SIZE - 1)
+#define TX_RING_SIZE    4096 ///< Output queue (must be a power of two)
+#define EVT_RING_SIZE   4096 ///< Event channel queue (must be a power of two)
+#define EVT_LINE_SIZE   160  ///< Longest single event line
+#define TX_RESERVE      1280 ///< Free output space required to accept a command (largest response)
 #define SINGLE_WIRE_PIN 2   ///< GPIO pin used for EEPROM emulation (open-drain)
 #define LED_PIN         25  ///< Onboard Pico LED (live indicator)
 
+// SEVONPEND bit of the System Control Register (named after the core in the SDK headers).
+// The Hazard3 cores have no SCB; their __wfe() (h3.block) wakes on a pending interrupt by itself.
+#if PICO_RISCV
+#define CPU_ARCH_NAME           "hazard3"
+#elif defined(PICO2)
+#define CPU_ARCH_NAME           "cortex-m33"
+#define SCB_SCR_SEVONPEND_BITS  M33_SCR_SEVONPEND_BITS
+#else
+#define CPU_ARCH_NAME           "cortex-m0plus"
+#define SCB_SCR_SEVONPEND_BITS  M0PLUS_SCR_SEVONPEND_BITS
+#endif
+
 // Define command codes.
 #define TX_BYTE     0x01
 #define DISCOVERY   0x02
 #define RX_BYTE     0x03  
 
-// Define ack/nack sequence
-#define SEND_ACK	0
-#define SEND_NACK	1
-
-// Timing constants for different speed settings.
-// Prusa timings are used as a baseline.
-#define T_PRUSA_LOW1_US   2
-#define T_PRUSA_LOW0_US   10
-#define T_PRUSA_RD_US     1
-#define T_PRUSA_MRS_US    1
-#define T_PRUSA_BIT_US    25
-
-// Atmel timing constants for standard speed.
-#define T_ATMEL_ST_LOW1_US    4
-#define T_ATMEL_ST_LOW0_US    24
-#define T_ATMEL_ST_RD_US      4
-#define T_ATMEL_ST_MRS_US     2
-#define T_ATMEL_ST_BIT_US     45
-        
-// Atmel timing constants for high speed.
-#define T_ATMEL_HI_LOW1_US    1
-#define T_ATMEL_HI_LOW0_US    10
-#define T_ATMEL_HI_RD_US      1
-#define T_ATMEL_HI_MRS_US     1
-#define T_ATMEL_HI_BIT_US     15
+#define SET_PROFILE 0x04
+#define RUN_WAVEFORM 0x05
+#define FLASH_PARK  0x06
+#define READ_SEQ    0x07
+#define WRITE_PAGE  0x08
+#define MEASURE_RISE 0x09
+#define SET_TUNING  0x0A
+#define ROM_ZONE_READ 0x0B
+#define BENCHMARK   0x0C
 
-// Global timing variables.
-// These are used by the bit-banging functions to generate precise delays.
-// Note: Since operations are blocking, these values remain constant during a single transaction.
-#define time_bit        T_PRUSA_BIT_US
-#define time_rd         T_PRUSA_RD_US
-#define time_mrs        T_PRUSA_MRS_US
-#define time_low1       T_PRUSA_LOW1_US
-#define time_low0       T_PRUSA_LOW0_US
-#define tx_one_btime    (T_PRUSA_BIT_US - T_PRUSA_LOW1_US)
-#define tx_zero_btime   (T_PRUSA_BIT_US - T_PRUSA_LOW0_US)
-#define rd_btime        (T_PRUSA_BIT_US - T_PRUSA_RD_US - T_PRUSA_MRS_US)
+// Timing profiles instantiated for the single-wire pin, indexed by the SET_PROFILE data byte.
+SWI_DEFINE_PROFILE(prusa, SINGLE_WIRE_PIN, SWI_TIMING_PRUSA);
+SWI_DEFINE_PROFILE(standard, SINGLE_WIRE_PIN, SWI_TIMING_ATMEL_ST);
+SWI_DEFINE_PROFILE(high, SINGLE_WIRE_PIN, SWI_TIMING_ATMEL_HI);
+// Timing set at run time from the measured rise time ("measureRise").
+SWI_DEFINE_TUNED_PROFILE(tuned, SINGLE_WIRE_PIN, SWI_TIMING_PRUSA);
+
+static const swi_profile_t *const swi_profiles[] = {
+    &swi_profile_prusa,
+    &swi_profile_standard,
+    &swi_profile_high,
+    &swi_profile_tuned,
+};
+
+// Highest clock the chip is specified for at the default core voltage. Faster builds
+// (SWI_SYS_CLK_KHZ) raise the core voltage before switching the PLL.
+#ifdef PICO2
+#define SYS_CLK_RATED_KHZ   150000
+#else
+#define SYS_CLK_RATED_KHZ   133000
+#endif
+#define SYS_CLK_TOLERANCE_KHZ   (SWI_SYS_CLK_KHZ / 100)  ///< Allowed frequency counter error
 
 /**
- * @brief Sets the single-wire pin to a high state.
- *
- * In open-drain emulation, setting the pin as input releases the line so that
- * the pull-up resistor can pull it high.
+ * @brief Result of the clock setup and of the timing table check.
  */
-static inline void sio_set_high(void) {
-    gpio_set_dir(SINGLE_WIRE_PIN, GPIO_IN);
-}
+typedef struct {
+    bool pll_ok;            ///< set_sys_clock_khz() accepted SWI_SYS_CLK_KHZ.
+    uint32_t measured_khz;  ///< clk_sys measured by the frequency counter.
+    const char *error;      ///< NULL if the cycle tables match the running clock.
+    const char *profile;    ///< Profile that failed the check, if any.
+} clock_status_t;
+
+static clock_status_t clock_status;
 
 /**
- * @brief Sets the single-wire pin to a low state.
+ * @brief Programs the system clock the timing tables were computed for.
  *
- * Configures the pin as an output, forcing the line low.
- * It is assumed that the output register is preset to 0.
+ * clk_usb runs from its own PLL and the timer from clk_ref, so USB and time_us_64()
+ * are not affected. Must run before anything depends on clk_peri.
  */
-static inline void sio_set_low(void) {
-    gpio_set_dir(SINGLE_WIRE_PIN, GPIO_OUT);
+static void clock_setup(void) {
+#if SWI_SYS_CLK_KHZ > SYS_CLK_RATED_KHZ
+    vreg_set_voltage(VREG_VOLTAGE_1_15);
+    sleep_ms(10);   // Let the regulator settle.
+#endif
+    clock_status.pll_ok = set_sys_clock_khz(SWI_SYS_CLK_KHZ, false);
 }
 
+#define RISE_BUDGET_US  50  ///< Longest rise time measured; slower lines count as timeouts
+
 /**
- * @brief Reads the current logic level of the single-wire pin.
- *
- * Configures the pin as an input and returns its state.
- *
- * @return The logic level (0 = low, 1 = high).
+ * @brief Rise time measurement, filled by Core1 for MEASURE_RISE.
  */
-static inline uint8_t sio_get_value(void) {
-    gpio_set_dir(SINGLE_WIRE_PIN, GPIO_IN);
-    return gpio_get(SINGLE_WIRE_PIN);
-}
+typedef struct {
+    uint16_t samples;       ///< Successful measurements.
+    uint16_t timeouts;      ///< Releases that did not read high within RISE_BUDGET_US.
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint32_t sum_cycles;
+} rise_result_t;
 
-/* Low-level protocol function declarations */
-uint8_t discovery_response(void);
-uint8_t tx_byte(uint8_t data_byte);
-uint8_t rx_byte(uint8_t ack);
-void tx_one(void);
-void tx_zero(void);
-uint8_t read_bit(void);
-uint8_t ack_nack(void);
-uint8_t read_byte(uint8_t ack);
+static rise_result_t rise_result;
+static swi_timing_t tune_timing;    ///< Timing handed to Core1 with SET_TUNING.
+static uint8_t tune_base;           ///< Profile the tuned timing derives from.
+static bool tune_set;               ///< tune_timing has been handed to Core1 (SET_TUNING).
 
 /**
- * @brief Busy-wait delay in microseconds using cycle counting.
- *
- * Converts the desired delay in microseconds to the equivalent number of CPU cycles,
- * taking into account the clock speed.
- *
- * For the original Pico (125 MHz), each cycle is ~8 ns.
- * For the Pico 2 (150 MHz), each cycle is ~6.67 ns.
- *
- * Adjust the calibration constant (-7) as needed for your application.
+ * @brief Checks that the delay tables are valid for the running clock.
  *
- * @param __us Delay duration in microseconds.
+ * The cycle counts are compile-time constants for SWI_SYS_CLK_KHZ, so clk_sys is measured
+ * and every profile is checked to still have delays longer than the delay call overhead.
+ * The tuned profile is checked with the timing last handed to Core1, once there is one.
  */
-#ifdef PICO2
-void soft_delay_us(double __us) {
-    // Pico 2: 6.67 ns per cycle (150 MHz)
-    uint32_t __count = (uint32_t)(__us / 0.00667) - 7;  
-    busy_wait_at_least_cycles(__count);
-}
-#else
-void soft_delay_us(double __us) {
-    // Original Pico: 8 ns per cycle (125 MHz)
-    uint32_t __count = (uint32_t)(__us / 0.008) - 7;
-    busy_wait_at_least_cycles(__count);
+static void clock_check(void) {
+    clock_status.measured_khz = frequency_count_khz(CLOCKS_FC0_SRC_VALUE_CLK_SYS);
+    clock_status.error = NULL;
+    clock_status.profile = NULL;
+    if (!clock_status.pll_ok) {
+        clock_status.error = "Clock not reachable by the PLL";
+    } else if (clock_status.measured_khz + SYS_CLK_TOLERANCE_KHZ < SWI_SYS_CLK_KHZ ||
+               clock_status.measured_khz > SWI_SYS_CLK_KHZ + SYS_CLK_TOLERANCE_KHZ) {
+        clock_status.error = "Clock differs from the timing tables";
+    } else {
+        for (size_t i = 0; i < count_of(swi_profiles) && !clock_status.error; i++) {
+            if (swi_profiles[i]->tuned && !tune_set) {
+                continue;
+            }
+            clock_status.error = swi_timing_check(swi_profiles[i]->tuned ? &tune_timing
+                                                                         : &swi_profiles[i]->timing);
+            clock_status.profile = swi_profiles[i]->name;
+        }
+    }
 }
-#endif
+
+#define BENCH_DELAY_US      10  ///< Delay timed by the benchmark
+#define BENCH_DELAY_RUNS    32
+#define BENCH_FRAMES        64  ///< Bit frames timed by the benchmark ('1' and '0' alternating)
 
 /**
- * @brief Performs the EEPROM discovery response sequence.
- *
- * Executes a series of pin toggles to simulate the discovery response.
- *
- * @return 0x00 if ACK is observed, or 0xFF if NACK is detected.
+ * @brief Delay and bit frame timing, filled by Core1 for BENCHMARK.
  */
-uint8_t discovery_response(void) {
-    uint8_t temp;
-    
-    sio_set_high();
-    soft_delay_us(200);  // tHTSS (Standard Speed)
-    sio_set_low();
-    soft_delay_us(150); //(500);  // tRESET (Standard Speed)
-    sio_set_high();
-    soft_delay_us(100); //(20);   // tRRT
+typedef struct {
+    uint32_t delay_min_cycles;  ///< soft_delay_us(BENCH_DELAY_US), as measured.
+    uint32_t delay_max_cycles;
+    uint32_t delay_sum_cycles;
+    uint32_t frame_cycles;      ///< All BENCH_FRAMES frames, as measured.
+    double bit_us;              ///< Nominal frame of the active profile.
+} bench_result_t;
 
-    sio_set_low();
-    soft_delay_us(1); // tDRR
-    sio_set_high();
-    soft_delay_us(3); //(2);    // tMSDR
-    temp = (sio_get_value() == 0) ? 0x00 : 0xFF;
-    soft_delay_us(150); //(21);   // tDACK delay
-    return temp;
-}
+static bench_result_t bench_result;
 
 /**
- * @brief Transmits a logic '1' bit.
+ * @brief Times the delay primitive and the bit frames of the active profile (Core1,
+ * interrupts disabled).
  *
- * Uses the global timing variables to determine the low pulse width and overall bit duration.
+ * The frames run the same deadline chain as the bit primitives, with the line left
+ * released, so the device sees no traffic. Both are timed with the cycle counter of
+ * the core.
  */
-void tx_one(void) {
-    sio_set_low();
-    soft_delay_us(time_low1);
-    sio_set_high();
-    soft_delay_us(tx_one_btime); 
-}
+static void __not_in_flash_func(bench_run)(const swi_bus_t *bus, bench_result_t *res) {
+    const swi_timing_t *t = swi_bus_timing(bus);
+    const swi_cycles_t c = swi_timing_cycles(*t);
 
-/**
- * @brief Transmits a logic '0' bit.
- *
- * Uses the global timing variables to determine the low pulse width and overall bit duration.
- */
-void tx_zero(void) {
-    sio_set_low(); 
-    soft_delay_us(time_low0);
-    sio_set_high();
-    soft_delay_us(tx_zero_btime); 
+    memset(res, 0, sizeof(*res));
+    res->delay_min_cycles = UINT32_MAX;
+    res->bit_us = t->bit_us;
+    for (int i = 0; i < BENCH_DELAY_RUNS; i++) {
+        uint32_t start = swi_cycle_counter();
+        soft_delay_us(BENCH_DELAY_US);
+        uint32_t cycles = (swi_cycle_counter() - start) & SWI_CYCLE_COUNTER_MASK;
+        res->delay_sum_cycles += cycles;
+        res->delay_min_cycles = MIN(res->delay_min_cycles, cycles);
+        res->delay_max_cycles = MAX(res->delay_max_cycles, cycles);
+    }
+    uint32_t start = swi_cycle_counter();
+    swi_deadline_t deadline = swi_deadline_start();
+    for (int i = 0; i < BENCH_FRAMES / 2; i++) {
+        swi_deadline_wait(&deadline, c.low1);
+        swi_deadline_wait(&deadline, c.high1);
+        swi_deadline_wait(&deadline, c.low0);
+        swi_deadline_wait(&deadline, c.high0);
+    }
+    res->frame_cycles = (swi_cycle_counter() - start) & SWI_CYCLE_COUNTER_MASK;
 }
 
+// Waveform micro-bytecode executed by Core1. Each instruction is one 32-bit word:
+// bits 31..24 opcode, bits 23..0 argument. Durations are in CPU cycles.
+#define WF_OP_END           0x00    /* Stop (implicit after the last word). */
+#define WF_OP_DRIVE_LOW     0x01    /* Drive the line low, then wait arg cycles. */
+#define WF_OP_RELEASE       0x02    /* Release the line, then wait arg cycles. */
+#define WF_OP_SAMPLE        0x03    /* Append the current line level to the sample buffer. */
+#define WF_OP_WAIT_UNTIL    0x04    /* Wait until the line equals bit 23, timeout bits 22..0 in us. */
+#define WF_OP_LOOP          0x05    /* Jump to bits 11..0 until the body ran bits 23..12 times. */
+#define WF_OP_EMIT_BIT      0x06    /* Send bit 0 as a protocol bit with the active profile timing. */
+
+#define WF_WAIT_LEVEL       (1u << 23)
+#define WF_ARG_MASK         0x00FFFFFFu
+#define WF_MAX_WORDS        64      ///< Longest program
+#define WF_MAX_SAMPLES      256     ///< Sample buffer size, in bits
+#define WF_MAX_LOOP_DEPTH   4       ///< Nested LOOP levels
+
+#define WF_OK               0x00
+#define WF_ERR_SAMPLES      0x01    /* Sample buffer overflow. */
+#define WF_ERR_LOOP_DEPTH   0x02    /* Too many nested loops. */
+#define WF_ERR_OPCODE       0x03    /* Unknown opcode. */
+
 /**
- * @brief Reads a single bit from the bus.
- *
- * Performs the required toggling and timing to read one bit from the EEPROM interface.
- *
- * @return The read bit (0 or 1).
+ * @brief Result of a waveform program, filled by Core1.
  */
-uint8_t read_bit(void) {
-    sio_set_low();
-    soft_delay_us(time_rd);         // Read delay period.
-    sio_set_high();
-    soft_delay_us(time_mrs);        // Minimum recovery time.
-    uint8_t temp = sio_get_value() & 0x01;
-    soft_delay_us(rd_btime);
-    sio_set_high();
-    return temp;
-}
+typedef struct {
+    uint8_t status;                         ///< WF_OK or WF_ERR_*.
+    uint16_t sample_count;                  ///< Bits stored in samples[].
+    uint16_t timeouts;                      ///< WAIT_UNTIL instructions that timed out.
+    uint8_t samples[WF_MAX_SAMPLES / 8];    ///< Sampled levels, MSB first.
+} wf_result_t;
+
+// Program and result shared between the cores. Core0 writes the program before
+// sending RUN_WAVEFORM and reads the result after Core1 answers.
+static uint32_t wf_program[WF_MAX_WORDS];
+static uint32_t wf_program_len;
+static wf_result_t wf_result;
+
+#define ROM_ZONE_COUNT  4   ///< ROM zones (quarters of the array), registers at 0x01/0x02/0x04/0x08
+#define ROM_ZONE_SET    0xFF    /* Zone register value of a ROM (write-protected) zone. */
+#define FREEZE_ADDR     0x55    /* Address and data bytes of the Freeze ROM Zone State command. */
+#define FREEZE_DATA     0xAA
+#define WRITE_POLL_MAX  40  ///< ACK polls after a page write (~20 ms with the 500 us gaps)
 
 /**
- * @brief Receives the ACK/NACK bit after transmission.
- *
- * Reads one bit to determine if an ACK (0x00) or NACK (0xFF) was received.
- *
- * @return 0x00 on ACK, 0xFF on NACK.
+ * @brief Block transfer handed to Core1 with READ_SEQ or WRITE_PAGE.
  */
-uint8_t ack_nack(void) {
-    return read_bit() ? 0xFF : 0x00;
-}
+typedef struct {
+    uint8_t opcode;                 ///< Memory opcode with the device address.
+    uint8_t start_addr;             ///< First address.
+    uint16_t len;                   ///< Bytes to transfer.
+    uint32_t write_us;              ///< WRITE_PAGE: stop condition to first ACK poll success.
+    uint32_t addr_gap_cycles;       ///< READ_SEQ: idle line between address load and read.
+    uint32_t byte_gap_cycles;       ///< READ_SEQ: extra idle time between data bytes.
+    uint8_t data[EEPROM_MAX_SIZE];  ///< Read destination / write source.
+} seq_request_t;
 
-void stop_con() {
-    soft_delay_us(500);
-}
+static seq_request_t seq_request;
 
 /**
- * @brief Transmits a byte bit-by-bit and then retrieves the ACK/NACK response.
- *
- * Iterates over each bit in the byte, transmitting using tx_one() or tx_zero()
- * based on the bit's value. After sending the byte, it reads the ACK/NACK.
+ * @brief Executes a waveform program on the bus (Core1, interrupts disabled).
  *
- * @param data_byte The byte to transmit.
- * @return The ACK/NACK code: 0x00 indicates an ACK; 0xFF indicates a NACK.
+ * The profile bit timing used by EMIT_BIT is converted to cycles before the first
+ * instruction, so the program itself runs at full speed. Durations are chained on one
+ * deadline (restarted after WAIT_UNTIL), so each edge lands its cycle count after the
+ * previous one whatever the interpreter costs in between. The line is always released
+ * at the end.
  */
-uint8_t tx_byte(uint8_t data_byte) {
-    for (uint8_t ii = 0; ii < 8; ii++) {
-        if (data_byte & 0x80) {
-            tx_one();
-        } else {
-            tx_zero();
+static void __not_in_flash_func(wf_run)(const swi_bus_t *bus, const uint32_t *prog, uint32_t len,
+                                        wf_result_t *res) {
+    const swi_timing_t *t = swi_bus_timing(bus);
+    const uint32_t low1 = swi_us_to_cycles(t->low1_us);
+    const uint32_t low0 = swi_us_to_cycles(t->low0_us);
+    const uint32_t high1 = swi_us_to_cycles(t->bit_us - t->low1_us);
+    const uint32_t high0 = swi_us_to_cycles(t->bit_us - t->low0_us);
+    const uint pin = bus->pin;
+    struct {
+        uint16_t pc;
+        uint16_t remaining;
+    } loops[WF_MAX_LOOP_DEPTH];
+    int depth = 0;
+    uint32_t pc = 0;
+
+    memset(res, 0, sizeof(*res));
+    swi_deadline_t deadline = swi_deadline_start();
+
+    while (pc < len && res->status == WF_OK) {
+        uint32_t op = prog[pc] >> 24;
+        uint32_t arg = prog[pc] & WF_ARG_MASK;
+
+        switch (op) {
+            case WF_OP_END:
+                pc = len;
+                continue;
+            case WF_OP_DRIVE_LOW:
+                swi_set_low(pin);
+                swi_deadline_wait(&deadline, arg);
+                break;
+            case WF_OP_RELEASE:
+                swi_set_high(pin);
+                swi_deadline_wait(&deadline, arg);
+                break;
+            case WF_OP_SAMPLE:
+                if (res->sample_count == WF_MAX_SAMPLES) {
+                    res->status = WF_ERR_SAMPLES;
+                    break;
+                }
+                if (gpio_get(pin)) {
+                    res->samples[res->sample_count / 8] |= 0x80 >> (res->sample_count % 8);
+                }
+                res->sample_count++;
+                break;
+            case WF_OP_WAIT_UNTIL: {
+                bool level = (arg & WF_WAIT_LEVEL) != 0;
+                uint32_t timeout_us = arg & ~WF_WAIT_LEVEL;
+                uint32_t start = time_us_32();
+                while (gpio_get(pin) != level) {
+                    if (time_us_32() - start >= timeout_us) {
+                        res->timeouts++;
+                        break;
+                    }
+                }
+                deadline = swi_deadline_start();
+                break;
+            }
+            case WF_OP_LOOP: {
+                uint32_t target = arg & 0xFFF;
+                uint32_t count = arg >> 12;
+                if (depth > 0 && loops[depth - 1].pc == pc) {
+                    if (--loops[depth - 1].remaining > 0) {
+                        pc = target;
+                        continue;
+                    }
+                    depth--;
+                } else if (count > 1) {
+                    if (depth == WF_MAX_LOOP_DEPTH) {
+                        res->status = WF_ERR_LOOP_DEPTH;
+                        break;
+                    }
+                    loops[depth].pc = (uint16_t)pc;
+                    loops[depth].remaining = (uint16_t)(count - 1);
+                    depth++;
+                    pc = target;
+                    continue;
+                }
+                break;
+            }
+            case WF_OP_EMIT_BIT:
+                swi_set_low(pin);
+                swi_deadline_wait(&deadline, (arg & 1) ? low1 : low0);
+                swi_set_high(pin);
+                swi_deadline_wait(&deadline, (arg & 1) ? high1 : high0);
+                break;
+            default:
+                res->status = WF_ERR_OPCODE;
+                break;
         }
-        data_byte <<= 1;
+        pc++;
     }
-    return ack_nack();
+    swi_set_high(pin);
 }
 
-/**
- * @brief Receives a byte bit-by-bit.
- *
- * Reads 8 bits from the bus using read_bit() and combines them to form a byte.
- *
- * @return The byte received from the bus.
- */
-uint8_t read_byte(uint8_t ack) {
-    uint8_t data_byte = 0;
-    uint8_t temp;
-    
-    for (int8_t ii = 0; ii < 8; ii++) {
-        temp = read_bit();
-        data_byte = (data_byte << 1) | temp;
-    }
-    
-    if(ack) {
-        tx_one();
-    } else {
-        tx_zero();
-    }
-    return data_byte;
-}
+// Flash write handshake: Core1 spins in RAM while Core0 erases/programs the flash.
+static volatile bool park_request;
+static volatile bool core1_parked;
+
+// Scheduled start of the next Core1 transaction, armed by schedule_run() on Core0.
+static volatile bool sched_armed;
+static volatile uint64_t sched_start_at;    ///< time_us_64() value to start at.
+static volatile uint64_t sched_started_us;  ///< Actual start, latched by Core1.
+
+// CPU cycles Core1 spent on its last transaction (cycle counter, interrupts off), for traces.
+static volatile uint32_t core1_cycles;
 
 /**
- * @brief Alias for read_byte to receive a byte.
- *
- * @return The byte received from the bus.
+ * @brief Keeps Core1 off the flash (runs from RAM, interrupts disabled) until released.
  */
-uint8_t rx_byte(uint8_t ack) {
-    return read_byte(ack);
+static void __not_in_flash_func(core1_park)(void) {
+    core1_parked = true;
+    while (park_request) {
+        tight_loop_contents();
+    }
+    core1_parked = false;
 }
 
 /**
- * @brief Initializes the single-wire pin for open-drain operation.
- *
- * Configures the pin as an input with an internal pull-up and sets the drive strength.
- * The output register is set to 0 so that switching to output immediately drives the line low.
+ * @brief Gives the EEPROM extra time between transactions (runs on Core0).
  */
-void init_open_drain_swi_pin(void) {
-    gpio_init(SINGLE_WIRE_PIN);
-    gpio_set_drive_strength(SINGLE_WIRE_PIN, GPIO_DRIVE_STRENGTH_12MA);
-    gpio_set_dir(SINGLE_WIRE_PIN, GPIO_IN);
-    gpio_pull_up(SINGLE_WIRE_PIN);
-    gpio_put(SINGLE_WIRE_PIN, 0);
+void stop_con() {
+    soft_delay_us(500);
 }
 
 /**
  * @brief Entry function for Core1.
  *
- * Core1 runs this function to process timing-critical commands received via FIFO.
- * It waits for a command from Core0, disables interrupts for precision,
- * executes the corresponding operation (transmission, reception, or discovery),
- * and sends back an acknowledgment.
+ * Core1 owns the bus context and runs this function to process timing-critical commands
+ * received via FIFO. It waits for a command from Core0, disables interrupts for precision,
+ * executes the corresponding operation (transmission, reception, or discovery) with the
+ * active timing profile, and sends back an acknowledgment.
  */
 void core1_entry(void) {
-    init_open_drain_swi_pin();
+    swi_bus_t bus;
+    swi_bus_init(&bus, swi_profiles[0]);
  
     while (true) {
         // Retrieve a command from Core0 via the FIFO.
@@ -347,23 +656,111 @@ void core1_entry(void) {
          
         // Disable interrupts to perform a precise, timing-critical operation.
         uint32_t irq_status = save_and_disable_interrupts();
-        switch (cmd) {
+        // A scheduled transaction starts at its deadline, timed here rather than over USB.
+        if (sched_armed && cmd != FLASH_PARK) {
+            while (time_us_64() < sched_start_at) {
+                tight_loop_contents();
+            }
+            sched_started_us = time_us_64();
+            sched_armed = false;
+        }
+        uint32_t cycles_start = swi_cycle_counter();
+        // A line held low fails the transaction at once instead of clocking out whole bytes.
+        // Waveforms are exempt: they may deliberately run against a low line.
+        bus.fault = SWI_FAULT_NONE;
+        bool line_check = (cmd == TX_BYTE || cmd == RX_BYTE || cmd == READ_SEQ || cmd == WRITE_PAGE ||
+                           cmd == ROM_ZONE_READ);
+        if (line_check && !swi_line_released(bus.pin, SWI_IDLE_HIGH_US)) {
+            bus.fault = SWI_FAULT_STUCK_LOW;
+            ack = 0xFF;
+        } else switch (cmd) {
             case TX_BYTE:
-                ack = tx_byte(data);
+                ack = swi_tx_byte(&bus, data);
                 break;
             case DISCOVERY:
-                ack = discovery_response();
+                ack = swi_discovery(&bus);
                 break;
             case RX_BYTE:
-                ack = rx_byte(data);
+                ack = swi_rx_byte(&bus, data);
+                break;
+            case SET_PROFILE:
+                ack = (data < count_of(swi_profiles) &&
+                       swi_bus_set_profile(&bus, swi_profiles[data])) ? 0x00 : 0xFF;
+                break;
+            case RUN_WAVEFORM:
+                wf_run(&bus, wf_program, wf_program_len, &wf_result);
+                __dmb();  // Result visible before the doorbell.
+                ack = wf_result.status;
+                break;
+            case READ_SEQ:
+                ack = swi_read_seq_gaps(&bus, seq_request.opcode, seq_request.start_addr,
+                                        seq_request.data, seq_request.len,
+                                        seq_request.addr_gap_cycles, seq_request.byte_gap_cycles);
+                __dmb();  // Data visible before the doorbell.
+                break;
+            case WRITE_PAGE: {
+                ack = swi_write_page(&bus, seq_request.opcode, seq_request.start_addr,
+                                     seq_request.data, seq_request.len);
+                uint32_t t0 = time_us_32();
+                if (!ack && !swi_ack_poll(&bus, seq_request.opcode, WRITE_POLL_MAX)) {
+                    ack = 0xFE;  // Write cycle never completed.
+                }
+                seq_request.write_us = time_us_32() - t0;
+                __dmb();
+                break;
+            }
+            case MEASURE_RISE:
+                memset(&rise_result, 0, sizeof(rise_result));
+                rise_result.min_cycles = UINT32_MAX;
+                for (uint8_t i = 0; i < data; i++) {
+                    uint32_t cycles = swi_measure_rise(&bus, RISE_BUDGET_US);
+                    if (cycles == 0) {
+                        rise_result.timeouts++;
+                        continue;
+                    }
+                    rise_result.samples++;
+                    rise_result.sum_cycles += cycles;
+                    rise_result.min_cycles = MIN(rise_result.min_cycles, cycles);
+                    rise_result.max_cycles = MAX(rise_result.max_cycles, cycles);
+                    soft_delay_us(10);
+                }
+                if (data > 0 && rise_result.samples == 0) {
+                    bus.fault = SWI_FAULT_STUCK_LOW;
+                }
+                __dmb();
+                ack = 0x00;
+                break;
+            case SET_TUNING:
+                swi_bus_tune(&bus, &tune_timing);
+                ack = (data < count_of(swi_profiles) && swi_profiles[data]->tuned &&
+                       swi_bus_set_profile(&bus, swi_profiles[data])) ? 0x00 : 0xFF;
+                break;
+            case ROM_ZONE_READ:
+                // All zone registers in one dispatch; register z is at address 1 << z.
+                ack = 0x00;
+                for (uint8_t z = 0; z < ROM_ZONE_COUNT && !ack; z++) {
+                    ack = swi_read_seq(&bus, seq_request.opcode, 1u << z, &seq_request.data[z], 1);
+                }
+                __dmb();
+                break;
+            case BENCHMARK:
+                bench_run(&bus, &bench_result);
+                __dmb();
+                ack = 0x00;
+                break;
+            case FLASH_PARK:
+                core1_park();
+                ack = 0x00;
                 break;
             default:
                 ack = 0xFF;  // Unknown command error.
                 break;
         }
+        core1_cycles = (swi_cycle_counter() - cycles_start) & SWI_CYCLE_COUNTER_MASK;
         restore_interrupts(irq_status);
-        // Send the ACK or response back to Core0.
-        multicore_fifo_push_blocking(ack);
+        __dmb();
+        // Send the ACK or response back to Core0, with the bus fault in bits 15..8.
+        multicore_fifo_push_blocking(ack | ((uint32_t)bus.fault << 8));
     }
 }
 
@@ -380,129 +777,681 @@ void core1_entry(void) {
 #define	RW_BIT                      0x01    /* The last bit of the opcode set Read (1) or Write (0) operation. */
 
 /**
- * @brief Sends a command (with associated data) to Core1 and waits for a response.
+ * @brief Per-connection console settings, changed by session commands.
+ */
+typedef struct {
+    bool echo;  ///< Echo received characters back to the host.
+    bool trace; ///< Report every Core1 transaction on the event channel.
+} session_t;
+
+static session_t session = {
+    .echo = true,
+    .trace = false,
+};
+
+// Command lanes. Control commands never touch the bus and are answered at once, even
+// while a bus command runs; bus commands are queued and run in arrival order.
+enum {
+    LANE_CONTROL,
+    LANE_BUS,
+    LANE_COUNT
+};
+
+static const char *const lane_names[LANE_COUNT] = { "control", "bus" };
+
+/**
+ * @brief Queueing statistics of one command lane.
+ */
+typedef struct {
+    uint32_t commands;          ///< Commands started.
+    uint32_t wait_last_us;      ///< Last command: line received to execution start.
+    uint32_t wait_max_us;
+} lane_stats_t;
+
+/**
+ * @brief Console counters reported by the "stats" command.
+ */
+typedef struct {
+    uint32_t commands;          ///< Command lines dispatched.
+    uint32_t busy_rejects;      ///< Command lines rejected because the output queue was full.
+    uint32_t evt_drops;         ///< Events dropped because the event queue was full.
+    uint32_t latency_last_us;   ///< Last command: line received to response handed to USB.
+    uint32_t latency_max_us;    ///< Worst command latency since boot.
+    uint32_t bus_faults;        ///< Commands failed by a stuck line.
+    uint32_t core1_timeouts;    ///< Core1 operations that never answered (Core1 restarted).
+    uint32_t cancels;           ///< Cancel requests handled (control byte or "cancel" command).
+    lane_stats_t lanes[LANE_COUNT];
+} tool_stats_t;
+
+static tool_stats_t stats;
+
+/**
+ * @brief Bounded output ring drained into one CDC interface by usb_service().
  *
- * Encodes the command and data into a 32-bit value: the upper 8 bits represent the command,
- * and the lower 8 bits represent the data. The function then waits for the response from Core1.
+ * The indexes are free running; the storage size must be a power of two.
+ */
+typedef struct {
+    uint8_t *buf;
+    uint32_t mask;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t high_water;        ///< Highest occupancy, in bytes.
+    uint32_t overflows;         ///< Bytes dropped because the ring was full.
+    uint8_t itf;                ///< CDC interface number the ring drains into.
+} out_queue_t;
+
+#define CDC_ITF_CONSOLE     0   ///< JSON command console.
+#define CDC_ITF_EVENTS      1   ///< Asynchronous traces and events.
+
+static uint8_t tx_ring[TX_RING_SIZE];
+static uint8_t evt_ring[EVT_RING_SIZE];
+
+static out_queue_t console_queue = { .buf = tx_ring, .mask = TX_RING_SIZE - 1, .itf = CDC_ITF_CONSOLE };
+static out_queue_t event_queue = { .buf = evt_ring, .mask = EVT_RING_SIZE - 1, .itf = CDC_ITF_EVENTS };
+
+// Command latency measurement, from the USB read that completed the line to
+// the moment its response has been handed to the CDC FIFO.
+static uint32_t latency_start_us;
+static bool latency_pending;
+
+/**
+ * @brief Returns the number of bytes waiting in an output queue.
+ */
+static inline uint32_t out_queue_used(const out_queue_t *q) {
+    return q->head - q->tail;
+}
+
+/**
+ * @brief Returns the number of bytes that can still be queued.
+ */
+static inline uint32_t out_queue_free(const out_queue_t *q) {
+    return q->mask + 1 - out_queue_used(q);
+}
+
+/**
+ * @brief Appends bytes to an output queue without blocking.
  *
- * @param cmd  The command code (8-bit).
- * @param data The accompanying data (8-bit).
- * @return The acknowledgment (8-bit) received from Core1.
+ * Bytes that do not fit are dropped and counted in q->overflows.
  */
-uint8_t send_cmd(uint8_t cmd, uint8_t data) {  
-    multicore_fifo_push_blocking((cmd << 24) | data);
-    return (uint8_t)multicore_fifo_pop_blocking();
+static void out_queue_put(out_queue_t *q, const char *buf, uint32_t len) {
+    uint32_t count = MIN(len, out_queue_free(q));
+
+    q->overflows += len - count;
+    for (uint32_t i = 0; i < count; i++) {
+        q->buf[(q->head + i) & q->mask] = (uint8_t)buf[i];
+    }
+    q->head += count;
+
+    if (out_queue_used(q) > q->high_water) {
+        q->high_water = out_queue_used(q);
+    }
 }
 
 /**
- * Return manufacturer device ID
- * 0x00D200 for AT21CS01
- * 0x00D380 for AT21CS11
+ * @brief Moves queued output into the CDC TX FIFO, as much as it can take.
  *
- * @return Manufacturer ID
+ * Output is discarded while no host has the port open, so a closed
+ * terminal cannot wedge the queue.
  */
-uint32_t read_mfr_id(uint8_t dev_addr) {
-    uint32_t id = 0;
-    uint8_t ack = send_cmd(DISCOVERY, 0);
-    if( !ack ) {
-        ack = send_cmd(TX_BYTE, OPCODE_MANUFACTURER_ID | dev_addr | RW_BIT);
-		
-        if(!ack) {
-            id = id | (send_cmd(RX_BYTE, SEND_ACK) << 16);
-            id = id | (send_cmd(RX_BYTE, SEND_ACK) << 8);
-            id = id | (send_cmd(RX_BYTE, SEND_NACK) << 0);
+static void out_queue_drain(out_queue_t *q) {
+    if (!tud_cdc_n_connected(q->itf)) {
+        q->tail = q->head;
+        return;
+    }
+    while (out_queue_used(q) > 0) {
+        uint32_t idx = q->tail & q->mask;
+        uint32_t span = MIN(out_queue_used(q), q->mask + 1 - idx);
+        uint32_t written = tud_cdc_n_write(q->itf, &q->buf[idx], span);
+        if (written == 0) {
+            break;  // CDC FIFO full; retry on the next service pass.
         }
-    }	    
-    return id;
+        q->tail += written;
+    }
+    tud_cdc_n_write_flush(q->itf);
 }
 
-int load_address(uint8_t dev_addr, uint8_t data_addr) {
-    // Check address is in range
-    if (data_addr > 128) { 
-        return -1;
-    }
-    
-    // Address device, return if device didn't ack
-    if (send_cmd(TX_BYTE, OPCODE_EEPROM_ACCESS | dev_addr | 0)) {
-        return -2;
+static void usb_rx_fill(void);
+static void usb_rx_process(void);
+static bool console_line_start;
+
+/**
+ * @brief Runs the USB device task and flushes queued output.
+ *
+ * Called from the main loop and while Core0 waits for Core1, so the output
+ * queues keep draining during bus work without ever blocking it. Received lines
+ * are sorted into their lanes here too, between response lines.
+ */
+static void usb_service(void) {
+    tud_task();
+    usb_rx_fill();  // Lets cancel_scan() see a cancel request while a command runs.
+    if (console_line_start) {
+        usb_rx_process();   // Control commands are answered even while a bus command runs.
     }
-    
-    // Select write address in device. Return if device didn't ack.
-    if (send_cmd(TX_BYTE, data_addr)) { 
-        return -3;
+    out_queue_drain(&console_queue);
+    out_queue_drain(&event_queue);
+    tud_cdc_n_read_flush(CDC_ITF_EVENTS);  // The event channel is output only.
+
+    // A command is complete once its whole response has left the console queue.
+    if (latency_pending && out_queue_used(&console_queue) == 0) {
+        latency_pending = false;
+        stats.latency_last_us = time_us_32() - latency_start_us;
+        if (stats.latency_last_us > stats.latency_max_us) {
+            stats.latency_max_us = stats.latency_last_us;
+        }
     }
-    return 1;
 }
 
 /**
- * Read byte from EEPROM
- * This function return int to allow for error states to be returned.
- * Should be cast to uint8_t for further procesing.
+ * @brief Queues one JSON line on the event channel.
  *
- * @param data_addr Address to read(0-127)
- * @return negative number if error occurred, data on address otherwise
+ * Events are all-or-nothing: a line that does not fit is dropped whole and
+ * counted in stats.evt_drops, so the stream never carries a torn record.
+ * Nothing is formatted while no host has the event port open.
  */
-int read_eeprom(uint8_t dev_addr, uint8_t data_addr) {
-    int data;
-    
-    // Load data address into Address Pointer.
-    int res = load_address(dev_addr, data_addr); 
-    if (res < 0) {
-        return res - 5;
-    }
-    
-    stop_con(); //-- wait 500uS
-    
-    // Address device, return if device didn't ack    
-    if (send_cmd(TX_BYTE, OPCODE_EEPROM_ACCESS | dev_addr | RW_BIT) ) { 
-        return -5;
+static void __attribute__((format(printf, 1, 2))) event_printf(const char *fmt, ...) {
+    char line[EVT_LINE_SIZE];
+    va_list args;
+
+    if (!tud_cdc_n_connected(CDC_ITF_EVENTS)) {
+        return;
     }
-    
-    data = (int)send_cmd(RX_BYTE, SEND_NACK); // Ready byte from bus
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
 
-    stop_con(); // Give EEPROM some extra time. Reduces errors.
-    return data;
+    if (len < 0 || len >= (int)sizeof(line) || (uint32_t)len > out_queue_free(&event_queue)) {
+        stats.evt_drops++;
+        return;
+    }
+    out_queue_put(&event_queue, line, (uint32_t)len);
 }
 
-int verified_read(uint8_t dev_addr, uint8_t data_addr) {
-    int data[3];
+// The console output ends with a complete line (nested responses may be inserted).
+static bool console_line_start = true;
 
-    data[0] = read_eeprom(dev_addr, data_addr);
-    data[1] = read_eeprom(dev_addr, data_addr);
+/**
+ * @brief stdio driver callback: queues output characters for the console interface.
+ *
+ * Never blocks. Command admission in usb_rx_process() keeps enough room free
+ * for a full response, so bytes are only dropped on misuse. Lines starting with
+ * '{' get a "t_us" device timestamp inserted as their first field.
+ */
+static void cdc_out_chars(const char *buf, int len) {
+    int from = 0;
 
-    if (data[0] == data[1]) {
-        return data[0];
+    // Stamp every response line with the device time: {"t_us":N,"status":...}.
+    for (int i = 0; i < len; i++) {
+        if (console_line_start && buf[i] == '{') {
+            char stamp[32];
+            int n = snprintf(stamp, sizeof(stamp), "\"t_us\":%llu,", (unsigned long long)time_us_64());
+            out_queue_put(&console_queue, &buf[from], (uint32_t)(i + 1 - from));
+            out_queue_put(&console_queue, stamp, (uint32_t)n);
+            from = i + 1;
+        }
+        console_line_start = (buf[i] == '\n');
     }
+    out_queue_put(&console_queue, &buf[from], (uint32_t)(len - from));
+}
 
-    // data mismatch, we need 3rd data to find out which one is correct
-    data[2] = read_eeprom(dev_addr, data_addr);
-
-    if (data[1] == data[2]) {
-        return data[1];
-    } else if (data[2] == data[0]) {
-        return data[2];
-    }    
-    return -1;
+/**
+ * @brief stdio driver callback: output is flushed asynchronously by usb_service().
+ */
+static void cdc_out_flush(void) {
 }
 
 /**
- * @brief Reads multiple bytes of data from the EEPROM.
+ * @brief stdio driver routing printf() to the TinyUSB CDC interface.
+ *
+ * Input is not handled here; commands are read in bulk by usb_rx_fill().
+ */
+static stdio_driver_t cdc_stdio_driver = {
+    .out_chars = cdc_out_chars,
+    .out_flush = cdc_out_flush,
+#if PICO_STDIO_ENABLE_CRLF_SUPPORT
+    .crlf_enabled = PICO_STDIO_DEFAULT_CRLF,
+#endif
+};
+
+// Core1 completion doorbell, written by core1_doorbell_isr().
+static volatile uint32_t core1_result;
+static volatile bool core1_done;
+
+// Set from the TinyUSB task when the console has received data.
+static volatile bool usb_rx_pending;
+
+/**
+ * @brief SIO FIFO interrupt: Core1 has pushed a result.
+ */
+static void core1_doorbell_isr(void) {
+    while (multicore_fifo_rvalid()) {
+        core1_result = multicore_fifo_pop_blocking();
+        core1_done = true;
+    }
+    multicore_fifo_clear_irq();
+}
+
+/**
+ * @brief TinyUSB callback: data arrived on a CDC interface.
+ */
+void tud_cdc_rx_cb(uint8_t itf) {
+    if (itf == CDC_ITF_CONSOLE) {
+        usb_rx_pending = true;
+    }
+}
+
+/**
+ * @brief Like core0_idle(), but also wakes up at the given deadline.
+ */
+static inline void core0_idle_until(absolute_time_t deadline) {
+    if (!tud_task_event_ready()) {
+        best_effort_wfe_or_timeout(deadline);
+    }
+}
+
+/**
+ * @brief Sleeps Core0 until the next event, unless USB work is already pending.
+ *
+ * Every event source is an interrupt (USB controller, Core1 doorbell, heartbeat
+ * timer) and SEVONPEND is set in main(), so an interrupt that arrives between
+ * the check and __wfe() still wakes the core.
+ */
+static inline void core0_idle(void) {
+    if (!tud_task_event_ready()) {
+        __wfe();
+    }
+}
+
+/**
+ * @brief Returns a printable name for a Core1 command code, used in traces.
+ */
+static const char *core1_cmd_name(uint8_t cmd) {
+    switch (cmd) {
+        case TX_BYTE:   return "TX_BYTE";
+        case DISCOVERY: return "DISCOVERY";
+        case RX_BYTE:   return "RX_BYTE";
+        case SET_PROFILE: return "SET_PROFILE";
+        case RUN_WAVEFORM: return "RUN_WAVEFORM";
+        case FLASH_PARK: return "FLASH_PARK";
+        case READ_SEQ:  return "READ_SEQ";
+        case WRITE_PAGE: return "WRITE_PAGE";
+        case MEASURE_RISE: return "MEASURE_RISE";
+        case SET_TUNING: return "SET_TUNING";
+        case ROM_ZONE_READ: return "ROM_ZONE_READ";
+        case BENCHMARK: return "BENCHMARK";
+        default:        return "UNKNOWN";
+    }
+}
+
+// Core1 operations that do not answer within this time are abandoned (Core1 is restarted).
+#define CORE1_TIMEOUT_US    1000000
+
+// Fault of the current command: set by send_cmd(), cleared by bus_fault_clear().
+#define BUS_FAULT_NONE          SWI_FAULT_NONE
+#define BUS_FAULT_STUCK_LOW     SWI_FAULT_STUCK_LOW
+#define BUS_FAULT_CORE1_TIMEOUT 0x80
+#define BUS_FAULT_CANCELLED     0x81
+
+static uint8_t bus_fault;
+
+// Cancellation: the CAN control byte, or a {"command":"cancel"} line, is spotted by
+// cancel_scan() as soon as it reaches the receive ring, even while a command runs.
+// send_cmd() then fails the next transaction with BUS_FAULT_CANCELLED, so the command
+// stops at a transaction boundary and reports what it has done so far.
+#define CANCEL_BYTE     0x18
+
+static bool cancel_pending;     ///< Set by cancel_scan(), consumed by cancel_finish().
+static bool cancel_hit;         ///< A bus operation was refused since the request.
+static uint32_t cancel_lines;   ///< "cancel" requests not yet answered by cancel_finish().
+static uint32_t cancel_seen;    ///< "cancel" lines found by cancel_scan() (free running).
+static uint32_t cancel_skipped; ///< Of those, lines lane_dispatch() has since dropped (free running).
+
+/**
+ * @brief What the last cancel request stopped, reported by the "cancel" command.
+ */
+typedef struct {
+    bool command;   ///< A running command was stopped at a transaction boundary.
+    bool watch;
+    bool soak;
+} cancel_result_t;
+
+static cancel_result_t cancel_last;
+static uint32_t cancel_dropped;     ///< Queued bus commands dropped by the last cancel.
+
+#define BUS_QUEUE_DEPTH 4   ///< Bus commands queued behind the running one
+
+/**
+ * @brief Bus command line waiting for its turn.
+ */
+typedef struct {
+    char line[BUFFER_SIZE];
+    uint32_t arrival_us;    ///< Time the line was received.
+} queued_cmd_t;
+
+// Bus lane FIFO. The indexes are free running; the slot at bus_queue_tail stays
+// in use while its command runs.
+static queued_cmd_t bus_queue[BUS_QUEUE_DEPTH];
+static uint32_t bus_queue_head;
+static uint32_t bus_queue_tail;
+static bool bus_running;            ///< A bus lane command is executing.
+static bool core1_busy;             ///< Core0 is waiting for Core1 (send_cmd(), flash writes).
+static uint8_t core1_profile;   ///< Profile index last set on Core1, restored after a restart.
+
+/**
+ * @brief Starts the fault tracking of a new command.
+ */
+static inline void bus_fault_clear(void) {
+    bus_fault = BUS_FAULT_NONE;
+}
+
+/**
+ * @brief Returns the error string of the current bus fault, or NULL.
+ */
+static const char *bus_fault_str(void) {
+    switch (bus_fault) {
+        case BUS_FAULT_NONE:          return NULL;
+        case BUS_FAULT_STUCK_LOW:     return "bus_stuck_low";
+        case BUS_FAULT_CORE1_TIMEOUT: return "core1_timeout";
+        case BUS_FAULT_CANCELLED:     return "cancelled";
+        default:                      return "bus_fault";
+    }
+}
+
+/**
+ * @brief Prints an error response if the current command hit a bus fault.
+ *
+ * @return true if the error was reported (the caller skips its own response).
+ */
+static bool bus_fault_report(const char *command) {
+    const char *fault = bus_fault_str();
+    if (!fault) {
+        return false;
+    }
+    printf("{\"status\":\"error\",\"command\":\"%s\",\"response\":\"%s\"}\n", command, fault);
+    return true;
+}
+
+/**
+ * @brief Resets and relaunches Core1 after it stopped answering.
+ *
+ * The launch handshake uses the FIFO, so the doorbell is disabled meanwhile. The
+ * timing profile (and tuning) is restored; everything else on Core1 is per-command state.
+ */
+static void core1_restart(void) {
+    irq_set_enabled(SIO_FIFO_IRQ_NUM(0), false);
+    multicore_reset_core1();
+    multicore_launch_core1(core1_entry);
+    multicore_fifo_clear_irq();
+    irq_set_enabled(SIO_FIFO_IRQ_NUM(0), true);
+
+    park_request = false;
+    core1_parked = false;
+    sched_armed = false;
+    core1_done = false;
+    uint8_t cmd = swi_profiles[core1_profile]->tuned ? SET_TUNING : SET_PROFILE;
+    multicore_fifo_push_blocking((cmd << 24) | core1_profile);
+    absolute_time_t deadline = make_timeout_time_us(CORE1_TIMEOUT_US);
+    while (!core1_done && !time_reached(deadline)) {
+        core0_idle_until(deadline);
+    }
+}
+
+/**
+ * @brief Sends a command (with associated data) to Core1 and waits for a response.
+ *
+ * Encodes the command and data into a 32-bit value: the upper 8 bits represent the command,
+ * and the lower 8 bits represent the data. The function then waits for the Core1 doorbell,
+ * running usb_service() in the meantime. With tracing enabled, the transaction is reported
+ * on the event channel.
+ *
+ * Once the current command has hit a bus fault, or a cancel request is pending, further
+ * calls fail at once without touching the bus. If Core1 does not answer within
+ * CORE1_TIMEOUT_US it is restarted.
+ *
+ * @param cmd  The command code (8-bit).
+ * @param data The accompanying data (8-bit).
+ * @return The acknowledgment (8-bit) received from Core1, 0xFF on a fault.
+ */
+uint8_t send_cmd(uint8_t cmd, uint8_t data) {  
+    if (cancel_pending && bus_fault == BUS_FAULT_NONE) {
+        bus_fault = BUS_FAULT_CANCELLED;
+        cancel_hit = true;
+    }
+    if (bus_fault != BUS_FAULT_NONE) {
+        return 0xFF;
+    }
+    uint32_t start_us = time_us_32();
+    absolute_time_t deadline = make_timeout_time_us(CORE1_TIMEOUT_US);
+    core1_done = false;
+    core1_busy = true;
+    multicore_fifo_push_blocking((cmd << 24) | data);
+    // Keep USB serviced and the output queues draining while Core1 works,
+    // sleeping until the next interrupt whenever there is nothing to do.
+    while (!core1_done) {
+        if (time_reached(deadline)) {
+            stats.core1_timeouts++;
+            bus_fault = BUS_FAULT_CORE1_TIMEOUT;
+            core1_restart();
+            core1_busy = false;
+            return 0xFF;
+        }
+        usb_service();
+        core0_idle_until(deadline);
+    }
+    core1_busy = false;
+    uint8_t result = (uint8_t)core1_result;
+    uint8_t fault = (uint8_t)(core1_result >> 8);
+    if (fault != SWI_FAULT_NONE) {
+        stats.bus_faults++;
+        bus_fault = fault;
+        result = 0xFF;
+    }
+
+    if (session.trace) {
+        event_printf("{\"event\":\"trace\",\"t_us\":%lu,\"op\":\"%s\",\"data\":\"0x%02X\","
+                     "\"result\":\"0x%02X\",\"dur_us\":%lu,\"core1_ns\":%lu%s}\n",
+                     (unsigned long)start_us, core1_cmd_name(cmd), data, result,
+                     (unsigned long)(time_us_32() - start_us),
+                     (unsigned long)(swi_cycles_to_us(core1_cycles) * 1000), fault ? ",\"fault\":true" : "");
+    }
+    return result;
+}
+
+/**
+ * @brief Services USB until the output queue can hold a full response.
+ *
+ * Used by commands that produce several responses, so they pace themselves to
+ * the host instead of being rejected as busy.
+ */
+static void console_wait_space(void) {
+    while (out_queue_free(&console_queue) < TX_RESERVE) {
+        usb_service();
+        core0_idle();
+    }
+}
+
+/**
+ * Return manufacturer device ID
+ * 0x00D200 for AT21CS01
+ * 0x00D380 for AT21CS11
+ *
+ * @return Manufacturer ID
+ */
+uint32_t read_mfr_id(uint8_t dev_addr) {
+    uint32_t id = 0;
+    uint8_t ack = send_cmd(DISCOVERY, 0);
+    if( !ack ) {
+        ack = send_cmd(TX_BYTE, OPCODE_MANUFACTURER_ID | dev_addr | RW_BIT);
+		
+        if(!ack) {
+            id = id | (send_cmd(RX_BYTE, SEND_ACK) << 16);
+            id = id | (send_cmd(RX_BYTE, SEND_ACK) << 8);
+            id = id | (send_cmd(RX_BYTE, SEND_NACK) << 0);
+        }
+    }	    
+    return id;
+}
+
+/**
+ * @brief Array geometry of a supported device.
+ */
+typedef struct {
+    uint32_t mfr_id;        ///< Manufacturer ID with the revision bits cleared.
+    const char *name;
+    uint16_t size;          ///< Array size in bytes (at most EEPROM_MAX_SIZE).
+    uint8_t page_size;      ///< Write page in bytes (at most EEPROM_PAGE_SIZE).
+} eeprom_geometry_t;
+
+// Known devices. The low 3 bits of the ID are the die revision and are ignored, so emulator
+// builds that report their own revision match the part they emulate.
+static const eeprom_geometry_t eeprom_table[] = {
+    { 0x00D200, "AT21CS01", 128, 8 },
+    { 0x00D380, "AT21CS11", 128, 8 },
+};
+#define MFR_ID_REV_MASK 0x000007
+
+/**
+ * @brief Looks up the geometry of a manufacturer ID.
+ *
+ * @return The table entry, or NULL if the ID is unknown.
+ */
+static const eeprom_geometry_t *eeprom_lookup(uint32_t mfr_id) {
+    for (size_t i = 0; i < sizeof(eeprom_table) / sizeof(eeprom_table[0]); i++) {
+        if (eeprom_table[i].mfr_id == (mfr_id & ~MFR_ID_REV_MASK)) {
+            return &eeprom_table[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Reads the manufacturer ID of a device and returns its geometry.
+ *
+ * @param mfr_id If not NULL, receives the ID read (0 if the device did not answer).
+ * @return The geometry, or NULL if the device is absent or unknown.
+ */
+static const eeprom_geometry_t *eeprom_identify(uint8_t dev_addr, uint32_t *mfr_id) {
+    uint32_t id = read_mfr_id(dev_addr);
+    if (mfr_id) {
+        *mfr_id = id;
+    }
+    return id ? eeprom_lookup(id) : NULL;
+}
+
+/**
+ * @brief Checks that [start, start + len) lies inside the array.
+ */
+static bool eeprom_range_ok(const eeprom_geometry_t *geo, uint32_t start, uint32_t len) {
+    return len != 0 && start < geo->size && len <= geo->size - start;
+}
+
+/**
+ * @brief Prints the error for a device that could not be identified.
+ */
+static void eeprom_identify_error(const char *command, uint32_t mfr_id) {
+    if (bus_fault_report(command)) {
+        return;
+    }
+    if (mfr_id == 0) {
+        printf("{\"status\":\"error\",\"command\":\"%s\",\"response\":\"No device\"}\n", command);
+    } else {
+        printf("{\"status\":\"error\",\"command\":\"%s\",\"response\":\"Unknown device 0x%06lX\"}\n",
+               command, (unsigned long)mfr_id);
+    }
+}
+
+int load_address(uint8_t dev_addr, uint8_t data_addr) {
+    // Check address is in range
+    if (data_addr >= EEPROM_MAX_SIZE) { 
+        return -1;
+    }
+    
+    // Address device, return if device didn't ack
+    if (send_cmd(TX_BYTE, OPCODE_EEPROM_ACCESS | dev_addr | 0)) {
+        return -2;
+    }
+    
+    // Select write address in device. Return if device didn't ack.
+    if (send_cmd(TX_BYTE, data_addr)) { 
+        return -3;
+    }
+    return 1;
+}
+
+/**
+ * Read byte from EEPROM
+ * This function return int to allow for error states to be returned.
+ * Should be cast to uint8_t for further procesing.
+ *
+ * @param data_addr Address to read(0-127)
+ * @return negative number if error occurred, data on address otherwise
+ */
+int read_eeprom(uint8_t dev_addr, uint8_t data_addr) {
+    int data;
+    
+    // Load data address into Address Pointer.
+    int res = load_address(dev_addr, data_addr); 
+    if (res < 0) {
+        return res - 5;
+    }
+    
+    stop_con(); //-- wait 500uS
+    
+    // Address device, return if device didn't ack    
+    if (send_cmd(TX_BYTE, OPCODE_EEPROM_ACCESS | dev_addr | RW_BIT) ) { 
+        return -5;
+    }
+    
+    data = (int)send_cmd(RX_BYTE, SEND_NACK); // Ready byte from bus
+
+    stop_con(); // Give EEPROM some extra time. Reduces errors.
+    return data;
+}
+
+int verified_read(uint8_t dev_addr, uint8_t data_addr) {
+    int data[3];
+
+    data[0] = read_eeprom(dev_addr, data_addr);
+    data[1] = read_eeprom(dev_addr, data_addr);
+
+    if (data[0] == data[1]) {
+        return data[0];
+    }
+
+    // data mismatch, we need 3rd data to find out which one is correct
+    data[2] = read_eeprom(dev_addr, data_addr);
+
+    if (data[1] == data[2]) {
+        return data[1];
+    } else if (data[2] == data[0]) {
+        return data[2];
+    }    
+    return -1;
+}
+
+/**
+ * @brief Reads multiple bytes of data from the EEPROM.
  *
  * This function reads a block of data starting at data_addr from the EEPROM.
- * It first checks that the requested block does not exceed the memory range
- * (assuming valid addresses 0 to 127). Then it sends a DISCOVERY command to verify
- * the presence of the EEPROM and proceeds to read each byte using verified_read(),
- * which reads the same EEPROM address multiple times for verification.
+ * It first checks that the requested block does not exceed the largest supported
+ * array (EEPROM_MAX_SIZE); callers check the device's own size (eeprom_identify()).
+ * Then it sends a DISCOVERY command to verify the presence of the EEPROM and proceeds
+ * to read each byte using verified_read(), which reads the same EEPROM address
+ * multiple times for verification.
  *
  * @param dev_addr The device address for EEPROM access.
- * @param data_addr The starting address in the EEPROM (0-127).
+ * @param data_addr The starting address in the EEPROM.
  * @param buffer A pointer to a buffer to store the read data.
  * @param len The number of bytes to read.
+ * @param read_len If not NULL, receives the number of bytes read, also on error
+ *                 (partial result of a cancelled read).
  * @return 1 on success, or a negative error code if an error occurs.
  */
-int read_block(uint8_t dev_addr, uint8_t data_addr, uint8_t *buffer, uint8_t len) {
-    // Validate that the block is within EEPROM address range (0 to 127)
-    if (data_addr + len > 128) {
+int read_block(uint8_t dev_addr, uint8_t data_addr, uint8_t *buffer, uint8_t len, uint8_t *read_len) {
+    if (read_len) {
+        *read_len = 0;
+    }
+    // Validate that the block is within the largest supported array
+    if (data_addr + len > EEPROM_MAX_SIZE) {
         return -1; // Block exceeds available memory.
     }
     
@@ -518,215 +1467,2194 @@ int read_block(uint8_t dev_addr, uint8_t data_addr, uint8_t *buffer, uint8_t len
             return -3; // Error occurred during EEPROM read.
         }
         buffer[i] = (uint8_t) res;
+        if (read_len) {
+            *read_len = (uint8_t)(i + 1);
+        }
     }
     return 1; // Success.
 }
 
 
 /**
- * @brief Compares a JSON token with a given string.
+ * @brief Reads a block with one sequential transaction on Core1, with explicit gaps.
+ *
+ * @param addr_gap_us Idle line between the address load and the read opcode.
+ * @param byte_gap_us Extra idle time between data bytes.
+ * @return 1 on success, -1 if the block is out of range, -2 if the device is absent,
+ *         -3 if it did not acknowledge.
+ */
+int read_seq_gaps(uint8_t dev_addr, uint8_t data_addr, uint8_t *buffer, uint8_t len,
+                  uint32_t addr_gap_us, uint32_t byte_gap_us) {
+    if (data_addr + len > EEPROM_MAX_SIZE) {
+        return -1;
+    }
+    if (send_cmd(DISCOVERY, 0)) {
+        return -2;
+    }
+    seq_request.opcode = OPCODE_EEPROM_ACCESS | dev_addr;
+    seq_request.start_addr = data_addr;
+    seq_request.len = len;
+    seq_request.addr_gap_cycles = swi_us_to_cycles(addr_gap_us);
+    seq_request.byte_gap_cycles = swi_us_to_cycles(byte_gap_us);
+    __dmb();
+    uint8_t ack = send_cmd(READ_SEQ, 0);
+    __dmb();
+    if (ack) {
+        return -3;
+    }
+    memcpy(buffer, seq_request.data, len);
+    return 1;
+}
+
+/**
+ * @brief Reads a block with one sequential transaction on Core1 (no per-byte verification).
+ *
+ * @return As read_seq_gaps().
+ */
+int read_seq(uint8_t dev_addr, uint8_t data_addr, uint8_t *buffer, uint8_t len) {
+    return read_seq_gaps(dev_addr, data_addr, buffer, len, SWI_START_STOP_US, 0);
+}
+
+// Gap discovery: candidate gaps, tried from the largest down. Byte gaps stay below tHTSS,
+// where the idle line would end the read. Address-load gaps stop at tHTSS: below it the read
+// opcode is no new start condition, and the device would write it to the latched address, so
+// the probe is only read-only down to that floor.
+static const uint16_t byte_gap_candidates_us[] = { 100, 75, 50, 30, 20, 10, 5, 2, 1, 0 };
+static const uint16_t addr_gap_candidates_us[] = { 500, 300, 200, SWI_HTSS_MIN_US };
+#define GAP_TRIES   3   ///< Consecutive good reads required at each gap
+
+/**
+ * @brief Shrinks one gap of a sequential read until the device stops answering correctly.
+ *
+ * The other gap stays at its largest candidate.
+ *
+ * @param reference Data read with the largest candidate gaps.
+ * @param addr_gap  true to shrink the address-load gap, false for the gap between data bytes.
+ * @return Smallest gap (us) at which every try ACKed and matched the reference, or -1.
+ */
+static int gap_probe(uint8_t dev_addr, uint8_t start_addr, uint8_t len, const uint8_t *reference,
+                     bool addr_gap) {
+    static uint8_t probe[EEPROM_MAX_SIZE];
+    int smallest = -1;
+
+    const uint16_t *candidates = addr_gap ? addr_gap_candidates_us : byte_gap_candidates_us;
+    uint32_t count = addr_gap ? count_of(addr_gap_candidates_us) : count_of(byte_gap_candidates_us);
+
+    for (uint32_t c = 0; c < count; c++) {
+        uint32_t gap = candidates[c];
+        for (int t = 0; t < GAP_TRIES; t++) {
+            int res = read_seq_gaps(dev_addr, start_addr, probe, len,
+                                    addr_gap ? gap : addr_gap_candidates_us[0],
+                                    addr_gap ? byte_gap_candidates_us[0] : gap);
+            if (res < 0 || memcmp(probe, reference, len) != 0) {
+                return smallest;
+            }
+        }
+        smallest = (int)gap;
+    }
+    return smallest;
+}
+
+/**
+ * @brief Writes bytes in one transaction on Core1 and waits for the write cycle by ACK polling.
+ *
+ * @param opcode   Full opcode with the device address (R/W bit clear).
+ * @param write_us If not NULL, receives the write cycle time measured by ACK polling.
+ * @return 1 on success, -3 on NACK, -4 if the write cycle did not complete.
+ */
+static int write_op(uint8_t opcode, uint8_t data_addr, const uint8_t *data, uint8_t len,
+                    uint32_t *write_us) {
+    seq_request.opcode = opcode;
+    seq_request.start_addr = data_addr;
+    seq_request.len = len;
+    memcpy(seq_request.data, data, len);
+    __dmb();
+    uint8_t ack = send_cmd(WRITE_PAGE, 0);
+    __dmb();
+    if (write_us) {
+        *write_us = seq_request.write_us;
+    }
+    if (ack) {
+        return (ack == 0xFE) ? -4 : -3;
+    }
+    return 1;
+}
+
+/**
+ * @brief Writes bytes within one page on Core1 and waits for the write cycle by ACK polling.
+ *
+ * @param geo      Geometry of the device (eeprom_identify()).
+ * @param write_us If not NULL, receives the write cycle time measured by ACK polling.
+ * @return 1 on success, -1 if the data crosses a page or the array end, -3 on NACK,
+ *         -4 if the write cycle did not complete.
+ */
+int write_page(const eeprom_geometry_t *geo, uint8_t dev_addr, uint8_t data_addr, const uint8_t *data,
+               uint8_t len, uint32_t *write_us) {
+    if (len == 0 || data_addr + len > geo->size ||
+        data_addr / geo->page_size != (data_addr + len - 1) / geo->page_size) {
+        return -1;
+    }
+    return write_op(OPCODE_EEPROM_ACCESS | dev_addr, data_addr, data, len, write_us);
+}
+
+/**
+ * @brief Reads the ROM zone registers (0x00 = writable, 0xFF = ROM) in one Core1 dispatch.
+ *
+ * @param zones Receives ROM_ZONE_COUNT register values.
+ * @return 1 on success, -2 if the device is absent, -3 on NACK.
+ */
+static int rom_zone_read(uint8_t dev_addr, uint8_t *zones) {
+    if (send_cmd(DISCOVERY, 0)) {
+        return -2;
+    }
+    seq_request.opcode = OPCODE_ROM_ZONE_REG_ACCESS | dev_addr;
+    __dmb();
+    uint8_t ack = send_cmd(ROM_ZONE_READ, 0);
+    __dmb();
+    if (ack) {
+        return -3;
+    }
+    memcpy(zones, seq_request.data, ROM_ZONE_COUNT);
+    return 1;
+}
+
+/**
+ * @brief Result of the protected-zone verification of one zone.
+ */
+typedef struct {
+    bool rom;       ///< Zone register reads as ROM.
+    bool nacked;    ///< The test write was refused.
+    bool intact;    ///< The byte read back unchanged (protected zones only).
+    bool pass;
+} rom_zone_check_t;
+
+/**
+ * @brief Verifies the write protection of every zone on the device.
+ *
+ * The first byte of each zone (a quarter of geo->size) is read. A protected zone gets a write of the inverted
+ * value, which must be NACKed and leave the byte unchanged; if it is accepted, the
+ * original value is written back. A writable zone gets its own value written back,
+ * which must be ACKed. No data changes unless protection is broken.
+ *
+ * @return 1 if the sequence ran (see checks[]), or a negative error code.
+ */
+static int rom_zone_verify(const eeprom_geometry_t *geo, uint8_t dev_addr, rom_zone_check_t *checks) {
+    uint8_t zones[ROM_ZONE_COUNT];
+    int res = rom_zone_read(dev_addr, zones);
+    if (res < 0) {
+        return res;
+    }
+    for (uint8_t z = 0; z < ROM_ZONE_COUNT; z++) {
+        uint8_t addr = z * (geo->size / ROM_ZONE_COUNT);
+        uint8_t orig, probe, after;
+        rom_zone_check_t *c = &checks[z];
+
+        memset(c, 0, sizeof(*c));
+        c->rom = (zones[z] == ROM_ZONE_SET);
+        if ((res = read_seq(dev_addr, addr, &orig, 1)) < 0) {
+            return res;
+        }
+        probe = c->rom ? (uint8_t)~orig : orig;
+        bus_fault_clear();
+        c->nacked = write_page(geo, dev_addr, addr, &probe, 1, NULL) == -3;
+        if (bus_fault != BUS_FAULT_NONE || (res = read_seq(dev_addr, addr, &after, 1)) < 0) {
+            return -5;
+        }
+        c->intact = (after == orig);
+        if (c->rom) {
+            if (!c->intact) {
+                write_page(geo, dev_addr, addr, &orig, 1, NULL);    // Protection is broken: restore.
+            }
+            c->pass = c->nacked && c->intact;
+        } else {
+            c->pass = !c->nacked && c->intact;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Region watched by the "watch" command.
+ */
+typedef struct {
+    bool active;
+    bool failing;                       ///< Last scan failed (errors are reported once).
+    bool primed;                        ///< snapshot holds a valid scan.
+    uint8_t dev_addr;
+    uint8_t start_addr;
+    uint8_t len;
+    uint32_t period_us;                 ///< Scan interval, start to start.
+    uint64_t next_us;                   ///< Device time of the next scan.
+    uint32_t scans;
+    uint8_t snapshot[EEPROM_MAX_SIZE];
+} watch_t;
+
+static watch_t watch;
+
+/**
+ * @brief Rescans the watched region when due and reports changed offsets as events.
+ *
+ * Called from the event loop between commands. Each changed byte produces one
+ * {"event":"watch",...} line on the event channel, so the traffic follows the
+ * change rate rather than the region size.
+ */
+static void watch_service(void) {
+    static uint8_t scan[EEPROM_MAX_SIZE];
+
+    if (!watch.active || cancel_pending || time_us_64() < watch.next_us) {
+        return;
+    }
+    uint64_t t_us = time_us_64();
+    watch.next_us = MAX(watch.next_us + watch.period_us, t_us);
+    watch.scans++;
+    bus_fault_clear();
+
+    int res = read_seq(watch.dev_addr, watch.start_addr, scan, watch.len);
+    if (bus_fault == BUS_FAULT_CANCELLED) {
+        return;
+    }
+    if (res < 0) {
+        if (!watch.failing) {
+            const char *fault = bus_fault_str();
+            event_printf("{\"event\":\"watch\",\"t_us\":%llu,\"error\":%d,\"fault\":\"%s\"}\n",
+                         (unsigned long long)t_us, res, fault ? fault : "none");
+        }
+        watch.failing = true;
+        return;
+    }
+    watch.failing = false;
+
+    if (watch.primed) {
+        for (uint8_t i = 0; i < watch.len; i++) {
+            if (scan[i] != watch.snapshot[i]) {
+                event_printf("{\"event\":\"watch\",\"t_us\":%llu,\"addr\":\"0x%02X\","
+                             "\"old\":\"0x%02X\",\"new\":\"0x%02X\"}\n", (unsigned long long)t_us,
+                             watch.start_addr + i, watch.snapshot[i], scan[i]);
+            }
+        }
+    }
+    memcpy(watch.snapshot, scan, watch.len);
+    watch.primed = true;
+}
+
+// Memory test patterns, in the order "all" runs them.
+enum {
+    MEMTEST_WALKING_ONES,
+    MEMTEST_WALKING_ZEROS,
+    MEMTEST_CHECKERBOARD,
+    MEMTEST_CHECKERBOARD_INV,
+    MEMTEST_ADDRESS,
+    MEMTEST_PRBS,
+    MEMTEST_COUNT
+};
+
+static const char *const memtest_names[MEMTEST_COUNT] = {
+    "walking1", "walking0", "checker", "checker_inv", "address", "prbs",
+};
+
+#define MEMTEST_PRBS_SEED   0xACE1u
+#define MEMTEST_MAX_FAILS   16  ///< Failing offsets listed per pattern (all are counted)
+
+/**
+ * @brief Fills buf with a test pattern for addresses 0..size-1.
+ */
+static void memtest_fill(int pattern, uint8_t *buf, uint16_t size) {
+    uint16_t lfsr = MEMTEST_PRBS_SEED;
+
+    for (uint16_t addr = 0; addr < size; addr++) {
+        switch (pattern) {
+            case MEMTEST_WALKING_ONES:     buf[addr] = (uint8_t)(1u << (addr % 8)); break;
+            case MEMTEST_WALKING_ZEROS:    buf[addr] = (uint8_t)~(1u << (addr % 8)); break;
+            case MEMTEST_CHECKERBOARD:     buf[addr] = (addr & 1) ? 0xAA : 0x55; break;
+            case MEMTEST_CHECKERBOARD_INV: buf[addr] = (addr & 1) ? 0x55 : 0xAA; break;
+            case MEMTEST_ADDRESS:          buf[addr] = (uint8_t)addr; break;
+            default:
+                // 16-bit Galois LFSR (x^16 + x^14 + x^13 + x^11 + 1), one byte per address.
+                for (int bit = 0; bit < 8; bit++) {
+                    lfsr = (lfsr >> 1) ^ ((lfsr & 1u) ? 0xB400u : 0u);
+                }
+                buf[addr] = (uint8_t)lfsr;
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Writes one pattern with page writes, reads it back sequentially and reports the result.
+ *
+ * Prints one response line with the error count and up to MEMTEST_MAX_FAILS failing
+ * offsets with their expected/read values and the failing bit mask.
+ *
+ * @return Number of failing bytes, or a negative error code if the bus failed.
+ */
+static int memtest_run(const eeprom_geometry_t *geo, uint8_t dev_addr, int pattern) {
+    static uint8_t expected[EEPROM_MAX_SIZE];
+    static uint8_t actual[EEPROM_MAX_SIZE];
+    const uint16_t size = geo->size;
+    int errors = 0;
+    int res = 1;
+
+    memtest_fill(pattern, expected, size);
+    for (uint16_t addr = 0; addr < size && res > 0; addr += geo->page_size) {
+        res = write_page(geo, dev_addr, (uint8_t)addr, &expected[addr], MIN(geo->page_size, size - addr), NULL);
+    }
+    if (res > 0) {
+        res = read_seq(dev_addr, 0, actual, (uint8_t)size);
+    }
+    console_wait_space();
+    if (res < 0) {
+        if (!bus_fault_report("memtest")) {
+            printf("{\"status\":\"error\",\"command\":\"memtest\",\"response\":{\"pattern\":\"%s\",\"error\":%d}}\n",
+                   memtest_names[pattern], res);
+        }
+        return res;
+    }
+
+    printf("{\"status\":\"success\",\"command\":\"memtest\",\"response\":{\"pattern\":\"%s\",\"fails\":[",
+           memtest_names[pattern]);
+    for (uint16_t addr = 0; addr < size; addr++) {
+        uint8_t mask = expected[addr] ^ actual[addr];
+        if (mask) {
+            if (errors < MEMTEST_MAX_FAILS) {
+                printf("%s{\"addr\":\"0x%02X\",\"exp\":\"0x%02X\",\"got\":\"0x%02X\",\"mask\":\"0x%02X\"}",
+                       errors ? "," : "", addr, expected[addr], actual[addr], mask);
+            }
+            errors++;
+        }
+    }
+    printf("],\"errors\":%d}}\n", errors);
+    return errors;
+}
+
+// Endurance (soak) test: write/verify cycles over a set of pages, run from the event loop.
+#define SOAK_PROGRESS_US    1000000 ///< Interval of the progress events
+#define SOAK_HIST_BINS      10
+
+// Upper edges of the write time histogram bins, in microseconds (the last bin is open).
+static const uint32_t soak_hist_edges[SOAK_HIST_BINS - 1] = {
+    1000, 1500, 2000, 3000, 4000, 5000, 7500, 10000, 20000,
+};
+
+/**
+ * @brief State and results of the endurance test.
+ */
+typedef struct {
+    bool active;
+    uint8_t dev_addr;
+    const eeprom_geometry_t *geo;       ///< Geometry of the device under test.
+    uint16_t page_mask;                 ///< Bit n selects page n.
+    uint32_t target_cycles;             ///< 0 runs until stopped.
+    uint32_t cycles;                    ///< Completed write/verify cycles.
+    uint32_t writes;                    ///< Page writes.
+    uint32_t fails;                     ///< Pages that failed to write or verify.
+    uint32_t first_fail_cycle;          ///< Cycle of the first failure (valid if fails > 0).
+    uint32_t write_us_min;
+    uint32_t write_us_max;
+    uint32_t hist[SOAK_HIST_BINS];      ///< Write time histogram (ACK polling).
+    uint64_t start_us;
+    uint64_t next_progress_us;
+} soak_t;
+
+static soak_t soak;
+
+/**
+ * @brief Runs one soak cycle: every selected page is written with the cycle's pattern
+ *        (rotating through the memtest patterns) and read back.
+ */
+static void soak_service(void) {
+    static uint8_t pattern[EEPROM_MAX_SIZE];
+    uint8_t readback[EEPROM_PAGE_SIZE];
+
+    if (!soak.active || cancel_pending) {
+        return;
+    }
+    const eeprom_geometry_t *geo = soak.geo;
+    memtest_fill(soak.cycles % MEMTEST_COUNT, pattern, geo->size);
+    for (uint8_t page = 0; page < geo->size / geo->page_size && page < 16; page++) {
+        if (!(soak.page_mask & (1u << page))) {
+            continue;
+        }
+        uint8_t addr = page * geo->page_size;
+        uint32_t write_us = 0;
+        bus_fault_clear();
+        int res = write_page(geo, soak.dev_addr, addr, &pattern[addr], geo->page_size, &write_us);
+        soak.writes++;
+        if (res > 0) {
+            int bin = 0;
+            while (bin < SOAK_HIST_BINS - 1 && write_us >= soak_hist_edges[bin]) {
+                bin++;
+            }
+            soak.hist[bin]++;
+            soak.write_us_min = MIN(soak.write_us_min, write_us);
+            soak.write_us_max = MAX(soak.write_us_max, write_us);
+            res = read_seq(soak.dev_addr, addr, readback, geo->page_size);
+        }
+        if (bus_fault == BUS_FAULT_CANCELLED) {
+            return;     // Incomplete cycle; cancel_finish() stops the test.
+        }
+        if (res < 0 || (res > 0 && memcmp(readback, &pattern[addr], geo->page_size) != 0)) {
+            if (soak.fails++ == 0) {
+                soak.first_fail_cycle = soak.cycles;
+                event_printf("{\"event\":\"soak_fail\",\"t_us\":%llu,\"cycle\":%lu,\"addr\":\"0x%02X\","
+                             "\"error\":%d}\n", (unsigned long long)time_us_64(),
+                             (unsigned long)soak.cycles, addr, res < 0 ? res : 0);
+            }
+        }
+    }
+    soak.cycles++;
+
+    uint64_t now_us = time_us_64();
+    bool done = soak.target_cycles && soak.cycles >= soak.target_cycles;
+    if (done || now_us >= soak.next_progress_us) {
+        event_printf("{\"event\":\"%s\",\"t_us\":%llu,\"cycles\":%lu,\"writes\":%lu,\"fails\":%lu,"
+                     "\"write_us_max\":%lu}\n", done ? "soak_done" : "soak",
+                     (unsigned long long)now_us, (unsigned long)soak.cycles, (unsigned long)soak.writes,
+                     (unsigned long)soak.fails, (unsigned long)soak.write_us_max);
+        soak.next_progress_us = now_us + SOAK_PROGRESS_US;
+    }
+    soak.active = !done;
+}
+
+/**
+ * @brief Prints the soak results as a console response.
+ */
+static void soak_report(void) {
+    printf("{\"status\":\"success\",\"command\":\"soak\",\"response\":{\"active\":%s,\"cycles\":%lu,"
+           "\"writes\":%lu,\"fails\":%lu,\"first_fail_cycle\":%ld,\"elapsed_us\":%llu,"
+           "\"write_us_min\":%lu,\"write_us_max\":%lu,\"hist_edges_us\":[",
+           soak.active ? "true" : "false", (unsigned long)soak.cycles, (unsigned long)soak.writes,
+           (unsigned long)soak.fails, soak.fails ? (long)soak.first_fail_cycle : -1L,
+           (unsigned long long)(time_us_64() - soak.start_us),
+           soak.writes ? (unsigned long)soak.write_us_min : 0UL, (unsigned long)soak.write_us_max);
+    for (int i = 0; i < SOAK_HIST_BINS - 1; i++) {
+        printf("%s%lu", i ? "," : "", (unsigned long)soak_hist_edges[i]);
+    }
+    printf("],\"hist\":[");
+    for (int i = 0; i < SOAK_HIST_BINS; i++) {
+        printf("%s%lu", i ? "," : "", (unsigned long)soak.hist[i]);
+    }
+    printf("]}}\n");
+}
+
+/**
+ * @brief Prints the "cancel" response: what the last cancel request stopped.
+ */
+static void cancel_print(void) {
+    printf("{\"status\":\"success\",\"command\":\"cancel\",\"response\":{\"command\":%s,"
+           "\"watch\":%s,\"soak\":%s,\"dropped\":%lu}}\n", cancel_last.command ? "true" : "false",
+           cancel_last.watch ? "true" : "false", cancel_last.soak ? "true" : "false",
+           (unsigned long)cancel_dropped);
+}
+
+/**
+ * @brief Completes a cancel request once the interrupted command has returned.
+ *
+ * Drops the queued bus commands, stops the background watch and soak test, reports the
+ * partial soak results on the event channel and answers the "cancel" lines received.
+ * Does nothing without a pending request.
+ */
+static void cancel_finish(void) {
+    if (!cancel_pending) {
+        return;
+    }
+    cancel_pending = false;
+    stats.cancels++;
+    cancel_last.command = cancel_hit;
+    cancel_last.watch = watch.active;
+    cancel_last.soak = soak.active;
+    cancel_hit = false;
+    uint32_t keep = bus_running ? 1 : 0;   // A macro cancelling itself keeps its own slot.
+    cancel_dropped = bus_queue_head - bus_queue_tail - keep;
+    bus_queue_head = bus_queue_tail + keep;
+    watch.active = false;
+    if (soak.active) {
+        soak.active = false;
+        event_printf("{\"event\":\"soak_cancelled\",\"t_us\":%llu,\"cycles\":%lu,\"writes\":%lu,"
+                     "\"fails\":%lu}\n", (unsigned long long)time_us_64(), (unsigned long)soak.cycles,
+                     (unsigned long)soak.writes, (unsigned long)soak.fails);
+    }
+    event_printf("{\"event\":\"cancel\",\"t_us\":%llu,\"command\":%s,\"watch\":%s,\"soak\":%s,"
+                 "\"dropped\":%lu}\n", (unsigned long long)time_us_64(), cancel_last.command ? "true" : "false",
+                 cancel_last.watch ? "true" : "false", cancel_last.soak ? "true" : "false",
+                 (unsigned long)cancel_dropped);
+    // "cancel" lines from the console are answered here, once the stopped command has returned.
+    for (; cancel_lines > 0; cancel_lines--) {
+        cancel_print();
+    }
+}
+
+// Destination of block reads. Commands run one at a time, so a single buffer
+// sized for the largest supported device replaces per-call heap allocations.
+static uint8_t block_buffer[EEPROM_MAX_SIZE];
+
+#define WF_INSN_CYCLES      32  ///< Interpreter cost of one instruction (upper bound)
+#define WF_MAX_DURATION_US  (CORE1_TIMEOUT_US / 2)  ///< Longest program, with margin to the Core1 timeout
+
+/**
+ * @brief Upper bound of the run time of a program with valid loops, in microseconds.
+ *
+ * Each instruction costs its wait (WAIT_UNTIL: its timeout) plus WF_INSN_CYCLES, times the
+ * run counts of the loops whose body contains it.
+ */
+static double wf_duration_us(const uint32_t *prog, uint32_t len, const swi_timing_t *t) {
+    double total = 0;
+
+    for (uint32_t pc = 0; pc < len; pc++) {
+        uint32_t arg = prog[pc] & WF_ARG_MASK;
+        double us = swi_cycles_to_us(WF_INSN_CYCLES);
+        switch (prog[pc] >> 24) {
+            case WF_OP_DRIVE_LOW:
+            case WF_OP_RELEASE:
+                us += swi_cycles_to_us(arg);
+                break;
+            case WF_OP_WAIT_UNTIL:
+                us += arg & ~WF_WAIT_LEVEL;
+                break;
+            case WF_OP_EMIT_BIT:
+                us += t->bit_us;
+                break;
+        }
+        for (uint32_t loop = pc; loop < len; loop++) {
+            uint32_t loop_arg = prog[loop] & WF_ARG_MASK;
+            if ((prog[loop] >> 24) == WF_OP_LOOP && (loop_arg & 0xFFF) <= pc) {
+                us *= loop_arg >> 12;
+            }
+        }
+        total += us;
+    }
+    return total;
+}
+
+/**
+ * @brief Checks a waveform program before it is handed to Core1.
+ *
+ * Programs that could outlast the Core1 timeout are rejected: send_cmd() would restart
+ * Core1 and report a failure while the program was still running correctly.
+ *
+ * @return NULL if the program is valid, otherwise an error message.
+ */
+static const char *wf_validate(const uint32_t *prog, uint32_t len) {
+    if (len == 0) {
+        return "Empty program";
+    }
+    for (uint32_t pc = 0; pc < len; pc++) {
+        uint32_t op = prog[pc] >> 24;
+        uint32_t arg = prog[pc] & WF_ARG_MASK;
+        if (op > WF_OP_EMIT_BIT) {
+            return "Unknown opcode";
+        }
+        if (op == WF_OP_LOOP && ((arg & 0xFFF) > pc || (arg >> 12) == 0)) {
+            return "Invalid loop";
+        }
+    }
+    const swi_timing_t *timing = swi_profiles[core1_profile]->tuned ? &tune_timing
+                                                                    : &swi_profiles[core1_profile]->timing;
+    if (wf_duration_us(prog, len, timing) > WF_MAX_DURATION_US) {
+        return "Program too long";
+    }
+    return NULL;
+}
+
+/**
+ * @brief Runs the program in wf_program on Core1 and waits for it to finish.
+ *
+ * @return WF_OK or a WF_ERR_* code; details are in wf_result.
+ */
+static uint8_t wf_execute(void) {
+    __dmb();  // Publish the program before Core1 is told to run it.
+    uint8_t status = send_cmd(RUN_WAVEFORM, 0);
+    __dmb();
+    return status;
+}
+
+// Stored command macros: one flash sector per macro at the end of the flash.
+#define MACRO_SLOTS         8
+#define MACRO_SLOT_SIZE     FLASH_SECTOR_SIZE
+#define MACRO_NAME_SIZE     24
+#define MACRO_MAGIC         0x5243414Du     /* "MACR" */
+#define MACRO_FLASH_OFFSET  (PICO_FLASH_SIZE_BYTES - MACRO_SLOTS * MACRO_SLOT_SIZE)
+
+/**
+ * @brief Header at the start of each macro sector, followed by the command lines.
+ */
+typedef struct {
+    uint32_t magic;                 ///< MACRO_MAGIC when the slot is in use.
+    char name[MACRO_NAME_SIZE];     ///< NUL-terminated macro name.
+    uint32_t length;                ///< Bytes of '\n'-separated JSON commands that follow.
+} macro_header_t;
+
+#define MACRO_TEXT_MAX      (MACRO_SLOT_SIZE - sizeof(macro_header_t))
+
+// Sector image being recorded between macroBegin and macroEnd.
+static union {
+    uint8_t bytes[MACRO_SLOT_SIZE];
+    macro_header_t header;
+} macro_staging __attribute__((aligned(4)));
+
+static struct {
+    bool recording;     ///< Lines are being appended to macro_staging.
+    bool overflow;      ///< The recorded text did not fit in one slot.
+    bool running;       ///< A macro is executing (no nested runs).
+    uint16_t commands;  ///< Lines recorded so far.
+} macro_state;
+
+void handle_command(char *json_str);
+
+/**
+ * @brief Returns the flash header of a macro slot (read through XIP).
+ */
+static inline const macro_header_t *macro_slot(int slot) {
+    return (const macro_header_t *)(uintptr_t)(XIP_BASE + MACRO_FLASH_OFFSET + slot * MACRO_SLOT_SIZE);
+}
+
+/**
+ * @brief Returns the slot holding the named macro, or -1.
+ */
+static int macro_find(const char *name) {
+    for (int slot = 0; slot < MACRO_SLOTS; slot++) {
+        const macro_header_t *hdr = macro_slot(slot);
+        if (hdr->magic == MACRO_MAGIC && strncmp(hdr->name, name, MACRO_NAME_SIZE) == 0) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+extern char __flash_binary_end;     // End of the firmware image in flash (linker script).
+
+/**
+ * @brief Tells whether the macro sectors lie beyond the end of the firmware image.
+ *
+ * A firmware image grown into the macro area would be erased by a macro write.
+ */
+static bool macro_flash_free(void) {
+    return (uintptr_t)&__flash_binary_end <= XIP_BASE + MACRO_FLASH_OFFSET;
+}
+
+/**
+ * @brief Erases a macro sector and optionally programs a new image into it.
+ *
+ * Core1 is parked in RAM for the duration, and Core0 runs with interrupts
+ * disabled, so nothing executes from flash while it is being written.
+ *
+ * If Core1 does not park within CORE1_TIMEOUT_US it is restarted and the sector is
+ * left untouched, like a send_cmd() timeout.
+ *
+ * @param slot  Slot index.
+ * @param image Sector image to program, or NULL to leave the slot erased.
+ * @return false if Core1 timed out before the write (bus_fault holds the reason).
+ */
+static bool macro_flash_write(int slot, const uint8_t *image) {
+    uint32_t offset = MACRO_FLASH_OFFSET + slot * MACRO_SLOT_SIZE;
+    absolute_time_t deadline = make_timeout_time_us(CORE1_TIMEOUT_US);
+
+    park_request = true;
+    core1_done = false;
+    multicore_fifo_push_blocking(FLASH_PARK << 24);
+    while (!core1_parked) {
+        if (time_reached(deadline)) {
+            stats.core1_timeouts++;
+            bus_fault = BUS_FAULT_CORE1_TIMEOUT;
+            core1_restart();
+            return false;
+        }
+        tight_loop_contents();
+    }
+
+    uint32_t irq_status = save_and_disable_interrupts();
+    flash_range_erase(offset, MACRO_SLOT_SIZE);
+    if (image) {
+        flash_range_program(offset, image, MACRO_SLOT_SIZE);
+    }
+    restore_interrupts(irq_status);
+
+    park_request = false;
+    deadline = make_timeout_time_us(CORE1_TIMEOUT_US);
+    core1_busy = true;
+    while (!core1_done) {
+        if (time_reached(deadline)) {
+            stats.core1_timeouts++;
+            core1_restart();    // The sector is already written.
+            break;
+        }
+        usb_service();
+        core0_idle_until(deadline);
+    }
+    core1_busy = false;
+    return true;
+}
+
+/**
+ * @brief Appends one command line to the macro being recorded.
+ */
+static void macro_record(const char *json_str) {
+    uint32_t len = strlen(json_str);
+    uint32_t used = macro_staging.header.length;
+
+    if (used + len + 1 > MACRO_TEXT_MAX) {
+        macro_state.overflow = true;
+        return;
+    }
+    memcpy(&macro_staging.bytes[sizeof(macro_header_t) + used], json_str, len);
+    macro_staging.bytes[sizeof(macro_header_t) + used + len] = '\n';
+    macro_staging.header.length = used + len + 1;
+    macro_state.commands++;
+}
+
+/**
+ * @brief Runs every command of a stored macro, streaming each response.
+ *
+ * Before each command the output queue is drained until a full response fits.
+ * A cancel request stops the macro after the current command.
+ *
+ * @return Number of commands executed.
+ */
+static uint32_t macro_run(int slot) {
+    static char line[BUFFER_SIZE];
+    const macro_header_t *hdr = macro_slot(slot);
+    const char *text = (const char *)(hdr + 1);
+    uint32_t length = MIN(hdr->length, (uint32_t)MACRO_TEXT_MAX);
+    uint32_t executed = 0;
+    uint32_t pos = 0;
+
+    macro_state.running = true;
+    while (pos < length && !cancel_pending) {
+        uint32_t n = 0;
+        while (pos + n < length && text[pos + n] != '\n') {
+            n++;
+        }
+        if (n > 0 && n < sizeof(line)) {
+            memcpy(line, &text[pos], n);
+            line[n] = '\0';
+            console_wait_space();
+            handle_command(line);
+            executed++;
+        }
+        pos += n + 1;
+    }
+    macro_state.running = false;
+    return executed;
+}
+
+// Scheduled execution: Core0 wakes SCHED_LEAD_US early and arms Core1, which
+// spins with interrupts disabled until the deadline before the first transaction.
+#define SCHED_LEAD_US   500
+
+static bool sched_active;   ///< A scheduled command is running (schedules do not nest).
+
+/**
+ * @brief Services USB and sleeps until the given device time, or until a cancel request.
+ */
+static void sched_wait_until(uint64_t t_us) {
+    absolute_time_t deadline = from_us_since_boot(t_us);
+    while (!time_reached(deadline) && !cancel_pending) {
+        usb_service();
+        core0_idle_until(deadline);
+    }
+}
+
+/**
+ * @brief Runs a command (or a macro) at a device timestamp, optionally periodically.
+ *
+ * Each run is followed by a "schedule" response with the target and the actual
+ * start time of its first bus transaction, and the lateness. Commands that do not
+ * use the bus report the time Core0 started them, up to SCHED_LEAD_US early.
+ * A cancel request ends the schedule before the next run.
+ *
+ * @param json_str  The command line, executed again for every run.
+ * @param at_us     Device time (time_us_64) of the first run, 0 for now.
+ * @param period_us Interval between runs.
+ * @param count     Number of runs.
+ */
+static void schedule_run(char *json_str, uint64_t at_us, uint32_t period_us, uint32_t count) {
+    if (at_us == 0) {
+        at_us = time_us_64() + SCHED_LEAD_US;
+    }
+
+    sched_active = true;
+    for (uint32_t n = 0; n < count; n++) {
+        uint64_t target_us = at_us + (uint64_t)n * period_us;
+
+        console_wait_space();
+        if (target_us > SCHED_LEAD_US) {
+            sched_wait_until(target_us - SCHED_LEAD_US);
+        }
+        if (cancel_pending) {
+            break;      // Runs already reported stay valid; no more are started.
+        }
+
+        // A target already passed is not armed: the run starts at once and reports its lateness.
+        uint64_t core0_start_us = time_us_64();
+        sched_start_at = target_us;
+        sched_started_us = 0;
+        __dmb();
+        sched_armed = (target_us > core0_start_us);
+        handle_command(json_str);
+        sched_armed = false;    // Not consumed if the command never reached Core1.
+
+        uint64_t start_us = sched_started_us ? sched_started_us : core0_start_us;
+        printf("{\"status\":\"success\",\"command\":\"schedule\",\"response\":{\"index\":%lu,"
+               "\"at_us\":%llu,\"start_us\":%llu,\"late_us\":%lld}}\n", (unsigned long)n,
+               (unsigned long long)target_us, (unsigned long long)start_us,
+               (long long)(start_us - target_us));
+    }
+    sched_active = false;
+}
+
+/**
+ * @brief Compares a JSON token with a given string.
+ *
+ * This helper function checks if the provided token (obtained using jsmn) is a string
+ * that exactly matches the given null-terminated string.
+ *
+ * @param json The entire JSON string.
+ * @param tok  The token to compare.
+ * @param s    The null-terminated string to compare against.
+ * @return 0 if the token matches the string; otherwise, -1.
+ */
+int jsoneq(const char *json, jsmntok_t *tok, const char *s) {
+    if (tok->type == JSMN_STRING &&
+        (int)strlen(s) == tok->end - tok->start &&
+        strncmp(json + tok->start, s, tok->end - tok->start) == 0) {
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief Answers a control command that takes no arguments ("ping", "sync", "stats" or "cancel").
+ *
+ * Used by handle_command() and, while a bus command is running, directly by the lane
+ * dispatcher, so a nested control command needs no jsmn tokens or field buffers of its own.
+ *
+ * @return false if the command is not one of these.
+ */
+static bool control_reply(const char *command) {
+    if (strcmp(command, "ping") == 0) {
+        printf("{\"status\":\"success\",\"command\":\"ping\",\"response\":\"pong\"}\n");
+    }
+    else if (strcmp(command, "sync") == 0) {
+        // Sampled as late as possible and pushed to USB right away, for offset/drift estimation.
+        printf("{\"status\":\"success\",\"command\":\"sync\",\"response\":{\"t_us\":%llu}}\n",
+               (unsigned long long)time_us_64());
+        usb_service();
+    }
+    else if (strcmp(command, "stats") == 0) {
+        printf("{\"status\":\"success\",\"command\":\"stats\",\"response\":{"
+               "\"commands\":%lu,\"busy_rejects\":%lu,"
+               "\"tx_queue_size\":%u,\"tx_queue_used\":%lu,\"tx_queue_high_water\":%lu,"
+               "\"tx_overflows\":%lu,\"evt_queue_high_water\":%lu,\"evt_drops\":%lu,"
+               "\"latency_last_us\":%lu,\"latency_max_us\":%lu,\"bus_faults\":%lu,\"core1_timeouts\":%lu,"
+               "\"cancels\":%lu,\"lanes\":{",
+               (unsigned long)stats.commands, (unsigned long)stats.busy_rejects,
+               TX_RING_SIZE, (unsigned long)out_queue_used(&console_queue),
+               (unsigned long)console_queue.high_water, (unsigned long)console_queue.overflows,
+               (unsigned long)event_queue.high_water, (unsigned long)stats.evt_drops,
+               (unsigned long)stats.latency_last_us, (unsigned long)stats.latency_max_us,
+               (unsigned long)stats.bus_faults, (unsigned long)stats.core1_timeouts,
+               (unsigned long)stats.cancels);
+        for (int lane = 0; lane < LANE_COUNT; lane++) {
+            printf("%s\"%s\":{\"commands\":%lu,\"wait_last_us\":%lu,\"wait_max_us\":%lu}", lane ? "," : "",
+                   lane_names[lane], (unsigned long)stats.lanes[lane].commands,
+                   (unsigned long)stats.lanes[lane].wait_last_us, (unsigned long)stats.lanes[lane].wait_max_us);
+        }
+        printf("}}}\n");
+    }
+    else if (strcmp(command, "cancel") == 0) {
+        // Console lines are acted on by cancel_scan(); a cancel stored in a macro gets here.
+        // Like those, it only raises the request: the running command stops at its next
+        // transaction and cancel_finish() answers and counts it once it has returned.
+        cancel_pending = true;
+        cancel_lines++;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Parses a JSON string using jsmn and dispatches commands.
+ *
+ * Extracts the "command", "data", "dev_addr", "start_addr", and "len" fields from the JSON string.
+ * For the "readBlock" command, it uses dev_addr, start_addr, and len fields to specify the EEPROM block
+ * to read. Other commands are dispatched as before. Responses are printed in JSON format.
+ *
+ * @param json_str The JSON command string.
+ */
+void handle_command(char *json_str) {
+    jsmn_parser parser;
+    jsmntok_t tokens[30];  // Increased token count to accommodate additional fields.
+    jsmn_init(&parser);
+    int token_count = jsmn_parse(&parser, json_str, strlen(json_str), tokens, 30);
+    if (token_count < 0) {
+        printf("{\"status\":\"error\",\"command\":\"parse\",\"response\":\"Failed to parse JSON\"}\n");
+        return;
+    }
+    if (token_count < 1 || tokens[0].type != JSMN_OBJECT) {
+        printf("{\"status\":\"error\",\"command\":\"parse\",\"response\":\"JSON object expected\"}\n");
+        return;
+    }
+    
+    char command[64] = {0};
+    char data[64] = {0};
+    char dev_addr_str[32] = {0};
+    char start_addr_str[32] = {0};
+    char len_str[32] = {0};
+    char name_str[MACRO_NAME_SIZE] = {0};
+    char at_us_str[24] = {0};
+    char period_us_str[24] = {0};
+    char count_str[24] = {0};
+    char interval_us_str[24] = {0};
+    char confirm_str[16] = {0};
+    // Waveform programs are long; keep them off the stack.
+    static char program_str[BUFFER_SIZE];
+    program_str[0] = '\0';
+    
+    // Iterate over tokens to extract expected fields.
+    for (int i = 1; i < token_count; i++) {
+        if (jsoneq(json_str, &tokens[i], "command") == 0) {
+            int length = tokens[i + 1].end - tokens[i + 1].start;
+            if (length < (int)sizeof(command)) {
+                strncpy(command, json_str + tokens[i + 1].start, length);
+                command[length] = '\0';
+            }
+            i++; // Skip value token.
+        }
+        else if (jsoneq(json_str, &tokens[i], "data") == 0) {
+            int length = tokens[i + 1].end - tokens[i + 1].start;
+            if (length < (int)sizeof(data)) {
+                strncpy(data, json_str + tokens[i + 1].start, length);
+                data[length] = '\0';
+            }
+            i++; // Skip value token.
+        }
+        else if (jsoneq(json_str, &tokens[i], "dev_addr") == 0) {
+            int length = tokens[i + 1].end - tokens[i + 1].start;
+            if (length < (int)sizeof(dev_addr_str)) {
+                strncpy(dev_addr_str, json_str + tokens[i + 1].start, length);
+                dev_addr_str[length] = '\0';
+            }
+            i++; // Skip value token.
+        }
+        else if (jsoneq(json_str, &tokens[i], "start_addr") == 0) {
+            int length = tokens[i + 1].end - tokens[i + 1].start;
+            if (length < (int)sizeof(start_addr_str)) {
+                strncpy(start_addr_str, json_str + tokens[i + 1].start, length);
+                start_addr_str[length] = '\0';
+            }
+            i++; // Skip value token.
+        }
+        else if (jsoneq(json_str, &tokens[i], "len") == 0) {
+            int length = tokens[i + 1].end - tokens[i + 1].start;
+            if (length < (int)sizeof(len_str)) {
+                strncpy(len_str, json_str + tokens[i + 1].start, length);
+                len_str[length] = '\0';
+            }
+            i++; // Skip value token.
+        }
+        else if (jsoneq(json_str, &tokens[i], "name") == 0) {
+            int length = tokens[i + 1].end - tokens[i + 1].start;
+            if (length < (int)sizeof(name_str)) {
+                strncpy(name_str, json_str + tokens[i + 1].start, length);
+                name_str[length] = '\0';
+            }
+            i++; // Skip value token.
+        }
+        else if (jsoneq(json_str, &tokens[i], "at_us") == 0) {
+            int length = tokens[i + 1].end - tokens[i + 1].start;
+            if (length < (int)sizeof(at_us_str)) {
+                strncpy(at_us_str, json_str + tokens[i + 1].start, length);
+                at_us_str[length] = '\0';
+            }
+            i++; // Skip value token.
+        }
+        else if (jsoneq(json_str, &tokens[i], "period_us") == 0) {
+            int length = tokens[i + 1].end - tokens[i + 1].start;
+            if (length < (int)sizeof(period_us_str)) {
+                strncpy(period_us_str, json_str + tokens[i + 1].start, length);
+                period_us_str[length] = '\0';
+            }
+            i++; // Skip value token.
+        }
+        else if (jsoneq(json_str, &tokens[i], "count") == 0) {
+            int length = tokens[i + 1].end - tokens[i + 1].start;
+            if (length < (int)sizeof(count_str)) {
+                strncpy(count_str, json_str + tokens[i + 1].start, length);
+                count_str[length] = '\0';
+            }
+            i++; // Skip value token.
+        }
+        else if (jsoneq(json_str, &tokens[i], "interval_us") == 0) {
+            int length = tokens[i + 1].end - tokens[i + 1].start;
+            if (length < (int)sizeof(interval_us_str)) {
+                strncpy(interval_us_str, json_str + tokens[i + 1].start, length);
+                interval_us_str[length] = '\0';
+            }
+            i++; // Skip value token.
+        }
+        else if (jsoneq(json_str, &tokens[i], "confirm") == 0) {
+            int length = tokens[i + 1].end - tokens[i + 1].start;
+            if (length < (int)sizeof(confirm_str)) {
+                strncpy(confirm_str, json_str + tokens[i + 1].start, length);
+                confirm_str[length] = '\0';
+            }
+            i++; // Skip value token.
+        }
+        else if (jsoneq(json_str, &tokens[i], "program") == 0) {
+            int length = tokens[i + 1].end - tokens[i + 1].start;
+            if (length < (int)sizeof(program_str)) {
+                strncpy(program_str, json_str + tokens[i + 1].start, length);
+                program_str[length] = '\0';
+            }
+            i++; // Skip value token.
+        }
+    }
+    
+    // While a macro is being recorded, every command except macroEnd is stored, not executed.
+    if (macro_state.recording && strcmp(command, "macroEnd") != 0) {
+        macro_record(json_str);
+        printf("{\"status\":\"%s\",\"command\":\"macroRecord\",\"response\":\"%s\"}\n",
+               macro_state.overflow ? "error" : "success",
+               macro_state.overflow ? "Macro too long" : command);
+        return;
+    }
+
+    // "at_us" / "period_us" turn any command into a scheduled one.
+    if (!sched_active && (at_us_str[0] != '\0' || period_us_str[0] != '\0')) {
+        uint64_t at_us = strtoull(at_us_str, NULL, 0);
+        uint32_t period_us = strtoul(period_us_str, NULL, 0);
+        uint32_t count = count_str[0] != '\0' ? strtoul(count_str, NULL, 0) : 1;
+        if (count == 0 || (count > 1 && period_us == 0)) {
+            printf("{\"status\":\"error\",\"command\":\"schedule\",\"response\":\"Invalid schedule\"}\n");
+            return;
+        }
+        schedule_run(json_str, at_us, period_us, count);
+        return;
+    }
+
+    // Dispatch commands based on the parsed "command" field.
+    bus_fault_clear();
+    if (strcmp(command, "discoveryResponse") == 0) {
+        uint8_t ack = send_cmd(DISCOVERY, 0);
+        if (bus_fault_report(command)) {
+            return;
+        }
+        const char *status_str = (ack == 0x00) ? "ACK" : "NACK";
+        printf("{\"status\":\"success\",\"command\":\"discoveryResponse\",\"response\":\"%s\"}\n", status_str);
+    }
+    else if (strcmp(command, "txByte") == 0) {
+        uint8_t data_val = 0;
+        unsigned int temp_val = 0;
+        if (strlen(data) > 0) {
+            if (sscanf(data, "0x%x", &temp_val) == 1) {
+                data_val = (uint8_t)temp_val;
+            }
+        }
+        uint8_t ack = send_cmd(TX_BYTE, data_val);  
+        if (bus_fault_report(command)) {
+            return;
+        }
+        const char *ack_str = (ack == 0x00) ? "ACK" : "NACK";
+        printf("{\"status\":\"success\",\"command\":\"txByte\",\"response\":\"%s\"}\n", ack_str);
+    }
+    else if (strcmp(command, "rxByte") == 0) {
+        uint8_t received = send_cmd(RX_BYTE, 0);  
+        if (bus_fault_report(command)) {
+            return;
+        }
+        printf("{\"status\":\"success\",\"command\":\"rxByte\",\"response\":\"0x%02X\"}\n", received);
+    }
+    else if (strcmp(command, "manufacturerId") == 0) {
+        uint8_t dev_addr = 0;
+        unsigned int temp_val = 0;
+        if (strlen(dev_addr_str) > 0) {
+            if (sscanf(dev_addr_str, "0x%x", &temp_val) == 1) {
+                dev_addr = (uint8_t)temp_val;
+            }
+        }
+        uint32_t received = read_mfr_id(dev_addr);  
+        if (bus_fault_report(command)) {
+            return;
+        }
+        /* If the manufacturer ID equals zero, that is considered an error. */
+        if (received == 0) {
+            printf("{\"status\":\"error\",\"command\":\"manufacturerId\",\"response\":\"Error: Manufacturer ID is zero\"}\n");
+        } else {
+            printf("{\"status\":\"success\",\"command\":\"manufacturerId\",\"response\":\"0x%08X\"}\n", received);
+        }
+    }
+    else if (strcmp(command, "readBlock") == 0) {
+        // Use parsed values from additional fields; if not provided, use defaults.
+        unsigned int dev_addr = 0;
+        unsigned int start_addr = 0;
+        unsigned int block_len = 0;   // default: up to the end of the array
+
+        if (strlen(dev_addr_str) > 0) {
+            sscanf(dev_addr_str, "0x%x", &dev_addr);
+        }
+        if (strlen(start_addr_str) > 0) {
+            sscanf(start_addr_str, "0x%x", &start_addr);
+        }
+        if (strlen(len_str) > 0) {
+            sscanf(len_str, "0x%x", &block_len);
+        }
+        
+        // Validate the host values before they are narrowed to 8 bits, then against the
+        // size of the device actually connected.
+        if ((dev_addr & ~0x0Eu) != 0 || start_addr >= EEPROM_MAX_SIZE || block_len > EEPROM_MAX_SIZE) {
+            printf("{\"status\":\"error\",\"command\":\"readBlock\",\"response\":\"Invalid range\"}\n");
+            return;
+        }
+        uint32_t mfr_id;
+        const eeprom_geometry_t *geo = eeprom_identify((uint8_t)dev_addr, &mfr_id);
+        if (geo == NULL) {
+            eeprom_identify_error(command, mfr_id);
+            return;
+        }
+        if (block_len == 0 && start_addr < geo->size) {
+            block_len = geo->size - start_addr;
+        }
+        if (!eeprom_range_ok(geo, start_addr, block_len)) {
+            printf("{\"status\":\"error\",\"command\":\"readBlock\",\"response\":\"Invalid range\"}\n");
+            return;
+        }
+        
+        uint8_t read_len;
+        int result = read_block((uint8_t)dev_addr, (uint8_t)start_addr, block_buffer, (uint8_t)block_len,
+                                &read_len);
+        bool cancelled = (bus_fault == BUS_FAULT_CANCELLED);
+        if (cancelled) {
+            block_len = read_len;   // Partial result: the bytes read before the cancel.
+        } else if (bus_fault_report(command)) {
+            return;
+        }
+        if (result < 0 && !cancelled) {
+            printf("{\"status\":\"error\",\"command\":\"readBlock\",\"response\":\"Error %d\"}\n", result);
+        } else {
+            // Build a JSON array with the values, inserting a newline after every 8 entries.
+		    printf("{\"status\":\"%s\",\"command\":\"readBlock\",\"response\":[\n",
+		           cancelled ? "cancelled" : "success");
+		    for (unsigned int i = 0; i < block_len; i++) {
+		        printf("\"0x%02X\"", block_buffer[i]);
+		        if (i < block_len - 1) {
+		            // Insert a comma after each value.
+		            if ((i + 1) % 8 == 0) {
+		                // After every 8 values, print a newline.
+		                printf(",\n");
+		            } else {
+		                printf(", ");
+		            }
+		        }
+		    }
+		    printf("\n]}\n");
+        }
+    }
+    else if (strcmp(command, "runWaveform") == 0) {
+        // The program is a list of hexadecimal instruction words, precompiled by the host.
+        const char *p = program_str;
+        char *end;
+        wf_program_len = 0;
+        while (*p != '\0' && wf_program_len < WF_MAX_WORDS) {
+            uint32_t word = (uint32_t)strtoul(p, &end, 16);
+            if (end == p) {
+                break;
+            }
+            wf_program[wf_program_len++] = word;
+            p = end;
+        }
+        while (*p == ' ') {
+            p++;
+        }
+        const char *err = (*p != '\0') ? "Invalid program" : wf_validate(wf_program, wf_program_len);
+        if (err) {
+            printf("{\"status\":\"error\",\"command\":\"runWaveform\",\"response\":\"%s\"}\n", err);
+            return;
+        }
+        static const char *const wf_status_str[] = { "OK", "Sample overflow", "Loop too deep", "Unknown opcode" };
+        uint8_t status = wf_execute();
+        if (bus_fault_report(command)) {
+            return;
+        }
+        printf("{\"status\":\"%s\",\"command\":\"runWaveform\",\"response\":{\"result\":\"%s\",\"samples\":\"",
+               (status == WF_OK) ? "success" : "error",
+               (status < count_of(wf_status_str)) ? wf_status_str[status] : "Error");
+        for (uint16_t i = 0; i < wf_result.sample_count; i++) {
+            putchar((wf_result.samples[i / 8] & (0x80 >> (i % 8))) ? '1' : '0');
+        }
+        printf("\",\"timeouts\":%u}}\n", wf_result.timeouts);
+    }
+    else if (strcmp(command, "macroBegin") == 0) {
+        if (name_str[0] == '\0' || macro_state.running) {
+            printf("{\"status\":\"error\",\"command\":\"macroBegin\",\"response\":\"Invalid name\"}\n");
+            return;
+        }
+        memset(&macro_staging, 0xFF, sizeof(macro_staging));
+        macro_staging.header.magic = MACRO_MAGIC;
+        memset(macro_staging.header.name, 0, MACRO_NAME_SIZE);
+        strcpy(macro_staging.header.name, name_str);
+        macro_staging.header.length = 0;
+        macro_state.recording = true;
+        macro_state.overflow = false;
+        macro_state.commands = 0;
+        printf("{\"status\":\"success\",\"command\":\"macroBegin\",\"response\":\"%s\"}\n", name_str);
+    }
+    else if (strcmp(command, "macroEnd") == 0) {
+        if (!macro_state.recording) {
+            printf("{\"status\":\"error\",\"command\":\"macroEnd\",\"response\":\"Not recording\"}\n");
+            return;
+        }
+        macro_state.recording = false;
+        if (!macro_flash_free()) {
+            printf("{\"status\":\"error\",\"command\":\"macroEnd\","
+                   "\"response\":\"Macro flash overlaps the firmware\"}\n");
+            return;
+        }
+        int slot = macro_find(macro_staging.header.name);
+        for (int i = 0; slot < 0 && i < MACRO_SLOTS; i++) {
+            if (macro_slot(i)->magic != MACRO_MAGIC) {
+                slot = i;
+            }
+        }
+        if (macro_state.overflow || macro_state.commands == 0 || slot < 0) {
+            printf("{\"status\":\"error\",\"command\":\"macroEnd\",\"response\":\"%s\"}\n",
+                   macro_state.overflow ? "Macro too long" : (slot < 0 ? "No free slot" : "Empty macro"));
+            return;
+        }
+        if (!macro_flash_write(slot, macro_staging.bytes)) {
+            bus_fault_report(command);
+            return;
+        }
+        printf("{\"status\":\"success\",\"command\":\"macroEnd\",\"response\":{\"name\":\"%s\","
+               "\"commands\":%u,\"bytes\":%lu}}\n", macro_staging.header.name, macro_state.commands,
+               (unsigned long)macro_staging.header.length);
+    }
+    else if (strcmp(command, "macroList") == 0) {
+        bool first = true;
+        printf("{\"status\":\"success\",\"command\":\"macroList\",\"response\":[");
+        for (int slot = 0; slot < MACRO_SLOTS; slot++) {
+            const macro_header_t *hdr = macro_slot(slot);
+            if (hdr->magic == MACRO_MAGIC) {
+                printf("%s{\"name\":\"%.*s\",\"bytes\":%lu}", first ? "" : ",", MACRO_NAME_SIZE - 1,
+                       hdr->name, (unsigned long)hdr->length);
+                first = false;
+            }
+        }
+        printf("]}\n");
+    }
+    else if (strcmp(command, "macroDelete") == 0) {
+        int slot = macro_find(name_str);
+        if (slot < 0 || macro_state.running) {
+            printf("{\"status\":\"error\",\"command\":\"macroDelete\",\"response\":\"Unknown macro\"}\n");
+            return;
+        }
+        if (!macro_flash_free()) {
+            printf("{\"status\":\"error\",\"command\":\"macroDelete\","
+                   "\"response\":\"Macro flash overlaps the firmware\"}\n");
+            return;
+        }
+        if (!macro_flash_write(slot, NULL)) {
+            bus_fault_report(command);
+            return;
+        }
+        printf("{\"status\":\"success\",\"command\":\"macroDelete\",\"response\":\"%s\"}\n", name_str);
+    }
+    else if (strcmp(command, "run") == 0) {
+        int slot = macro_find(name_str);
+        if (slot < 0 || macro_state.running) {
+            printf("{\"status\":\"error\",\"command\":\"run\",\"response\":\"%s\"}\n",
+                   macro_state.running ? "Nested run" : "Unknown macro");
+            return;
+        }
+        uint32_t executed = macro_run(slot);
+        printf("{\"status\":\"success\",\"command\":\"run\",\"response\":{\"name\":\"%s\",\"commands\":%lu}}\n",
+               name_str, (unsigned long)executed);
+    }
+    else if (strcmp(command, "watch") == 0) {
+        uint32_t dev_addr = strtoul(dev_addr_str, NULL, 16);
+        uint32_t start_addr = strtoul(start_addr_str, NULL, 16);
+        uint32_t watch_len = strtoul(len_str, NULL, 16);
+        if (strcmp(data, "stop") == 0) {
+            printf("{\"status\":\"success\",\"command\":\"watch\",\"response\":{\"active\":false,"
+                   "\"scans\":%lu}}\n", (unsigned long)watch.scans);
+            watch.active = false;
+            return;
+        }
+        if ((dev_addr & ~0x0Eu) || watch_len == 0 || start_addr + watch_len > EEPROM_MAX_SIZE) {
+            printf("{\"status\":\"error\",\"command\":\"watch\",\"response\":\"Invalid range\"}\n");
+            return;
+        }
+        uint32_t mfr_id;
+        const eeprom_geometry_t *geo = eeprom_identify((uint8_t)dev_addr, &mfr_id);
+        if (geo == NULL) {
+            eeprom_identify_error(command, mfr_id);
+            return;
+        }
+        if (!eeprom_range_ok(geo, start_addr, watch_len)) {
+            printf("{\"status\":\"error\",\"command\":\"watch\",\"response\":\"Invalid range\"}\n");
+            return;
+        }
+        memset(&watch, 0, sizeof(watch));
+        watch.dev_addr = (uint8_t)dev_addr;
+        watch.start_addr = (uint8_t)start_addr;
+        watch.len = (uint8_t)watch_len;
+        watch.period_us = interval_us_str[0] != '\0' ? strtoul(interval_us_str, NULL, 0) : 100000;
+        watch.next_us = time_us_64();
+        watch.active = true;
+        printf("{\"status\":\"success\",\"command\":\"watch\",\"response\":{\"active\":true,"
+               "\"interval_us\":%lu}}\n", (unsigned long)watch.period_us);
+    }
+    else if (strcmp(command, "memtest") == 0) {
+        uint32_t dev_addr = strtoul(dev_addr_str, NULL, 16);
+        int first = 0;
+        int last = MEMTEST_COUNT - 1;
+        if (data[0] != '\0' && strcmp(data, "all") != 0) {
+            for (first = 0; first < MEMTEST_COUNT && strcmp(data, memtest_names[first]) != 0; first++) {
+            }
+            last = first;
+        }
+        if ((dev_addr & ~0x0Eu) || first >= MEMTEST_COUNT) {
+            printf("{\"status\":\"error\",\"command\":\"memtest\",\"response\":\"Invalid arguments\"}\n");
+            return;
+        }
+        uint32_t mfr_id;
+        const eeprom_geometry_t *geo = eeprom_identify((uint8_t)dev_addr, &mfr_id);
+        if (geo == NULL) {
+            eeprom_identify_error(command, mfr_id);
+            return;
+        }
+        int failed_patterns = 0;
+        int patterns = 0;
+        for (int pattern = first; pattern <= last && !cancel_pending; pattern++) {
+            int res = memtest_run(geo, (uint8_t)dev_addr, pattern);
+            if (bus_fault == BUS_FAULT_CANCELLED) {
+                break;
+            }
+            if (res != 0) {
+                failed_patterns++;
+            }
+            patterns++;
+        }
+        console_wait_space();
+        printf("{\"status\":\"%s\",\"command\":\"memtest\",\"response\":{\"patterns\":%d,\"failed\":%d}}\n",
+               cancel_pending ? "cancelled" : failed_patterns ? "error" : "success", patterns, failed_patterns);
+    }
+    else if (strcmp(command, "soak") == 0) {
+        if (strcmp(data, "stop") == 0 || strcmp(data, "status") == 0) {
+            if (strcmp(data, "stop") == 0) {
+                soak.active = false;
+            }
+            soak_report();
+            return;
+        }
+        uint32_t dev_addr = strtoul(dev_addr_str, NULL, 16);
+        uint32_t page_mask = data[0] != '\0' ? strtoul(data, NULL, 16) : 0xFFFF;
+        if ((dev_addr & ~0x0Eu) || page_mask == 0 || page_mask > 0xFFFF) {
+            printf("{\"status\":\"error\",\"command\":\"soak\",\"response\":\"Invalid arguments\"}\n");
+            return;
+        }
+        uint32_t mfr_id;
+        const eeprom_geometry_t *geo = eeprom_identify((uint8_t)dev_addr, &mfr_id);
+        if (geo == NULL) {
+            eeprom_identify_error(command, mfr_id);
+            return;
+        }
+        // page_mask selects at most 16 pages.
+        if (geo->size / geo->page_size < 16 && (page_mask >> (geo->size / geo->page_size)) != 0) {
+            printf("{\"status\":\"error\",\"command\":\"soak\",\"response\":\"Invalid arguments\"}\n");
+            return;
+        }
+        memset(&soak, 0, sizeof(soak));
+        soak.dev_addr = (uint8_t)dev_addr;
+        soak.geo = geo;
+        soak.page_mask = (uint16_t)page_mask;
+        soak.target_cycles = strtoul(count_str, NULL, 0);
+        soak.write_us_min = UINT32_MAX;
+        soak.start_us = time_us_64();
+        soak.next_progress_us = soak.start_us + SOAK_PROGRESS_US;
+        soak.active = true;
+        printf("{\"status\":\"success\",\"command\":\"soak\",\"response\":{\"active\":true,"
+               "\"pages\":\"0x%04X\",\"cycles\":%lu}}\n", soak.page_mask, (unsigned long)soak.target_cycles);
+    }
+    else if (strcmp(command, "gapProbe") == 0) {
+        uint32_t dev_addr = strtoul(dev_addr_str, NULL, 16);
+        uint32_t start_addr = strtoul(start_addr_str, NULL, 16);
+        uint32_t probe_len = len_str[0] != '\0' ? strtoul(len_str, NULL, 16) : 0x10;
+        if ((dev_addr & ~0x0Eu) || probe_len < 2 || start_addr + probe_len > EEPROM_MAX_SIZE) {
+            printf("{\"status\":\"error\",\"command\":\"gapProbe\",\"response\":\"Invalid range\"}\n");
+            return;
+        }
+        uint32_t mfr_id;
+        const eeprom_geometry_t *geo = eeprom_identify((uint8_t)dev_addr, &mfr_id);
+        if (geo == NULL) {
+            eeprom_identify_error(command, mfr_id);
+            return;
+        }
+        if (!eeprom_range_ok(geo, start_addr, probe_len)) {
+            printf("{\"status\":\"error\",\"command\":\"gapProbe\",\"response\":\"Invalid range\"}\n");
+            return;
+        }
+        // Reference read at the largest (safest) candidate gaps.
+        int res = read_seq_gaps((uint8_t)dev_addr, (uint8_t)start_addr, block_buffer, (uint8_t)probe_len,
+                                addr_gap_candidates_us[0], byte_gap_candidates_us[0]);
+        if (res < 0) {
+            if (!bus_fault_report(command)) {
+                printf("{\"status\":\"error\",\"command\":\"gapProbe\",\"response\":\"Error %d\"}\n", res);
+            }
+            return;
+        }
+        int byte_gap = gap_probe((uint8_t)dev_addr, (uint8_t)start_addr, (uint8_t)probe_len, block_buffer, false);
+        int addr_gap = gap_probe((uint8_t)dev_addr, (uint8_t)start_addr, (uint8_t)probe_len, block_buffer, true);
+        if (bus_fault_report(command)) {
+            return;
+        }
+        printf("{\"status\":\"success\",\"command\":\"gapProbe\",\"response\":{\"byte_gap_us\":%d,"
+               "\"addr_gap_us\":%d,\"tries\":%d}}\n", byte_gap, addr_gap, GAP_TRIES);
+    }
+    else if (strcmp(command, "romZoneRead") == 0) {
+        uint32_t dev_addr = strtoul(dev_addr_str, NULL, 16);
+        uint8_t zones[ROM_ZONE_COUNT];
+        int res = (dev_addr & ~0x0Eu) ? -1 : rom_zone_read((uint8_t)dev_addr, zones);
+        if (res < 0) {
+            if (!bus_fault_report(command)) {
+                printf("{\"status\":\"error\",\"command\":\"romZoneRead\",\"response\":\"Error %d\"}\n", res);
+            }
+            return;
+        }
+        printf("{\"status\":\"success\",\"command\":\"romZoneRead\",\"response\":[");
+        for (int z = 0; z < ROM_ZONE_COUNT; z++) {
+            printf("%s\"0x%02X\"", z ? ", " : "", zones[z]);
+        }
+        printf("]}\n");
+    }
+    else if (strcmp(command, "romZoneSet") == 0) {
+        // Permanent: a zone set to ROM cannot be made writable again. Needs "confirm":"confirm",
+        // as "data" carries the zone mask.
+        uint32_t dev_addr = strtoul(dev_addr_str, NULL, 16);
+        uint32_t zone_mask = strtoul(data, NULL, 16);
+        if ((dev_addr & ~0x0Eu) || zone_mask == 0 || zone_mask >= (1u << ROM_ZONE_COUNT) ||
+            strcmp(confirm_str, "confirm") != 0) {
+            printf("{\"status\":\"error\",\"command\":\"romZoneSet\",\"response\":\"Invalid arguments\"}\n");
+            return;
+        }
+        int res = send_cmd(DISCOVERY, 0) ? -2 : 1;
+        for (uint8_t z = 0; z < ROM_ZONE_COUNT && res > 0; z++) {
+            if (zone_mask & (1u << z)) {
+                uint8_t value = ROM_ZONE_SET;
+                res = write_op(OPCODE_ROM_ZONE_REG_ACCESS | dev_addr, 1u << z, &value, 1, NULL);
+            }
+        }
+        uint8_t zones[ROM_ZONE_COUNT];
+        if (res > 0) {
+            res = rom_zone_read((uint8_t)dev_addr, zones);
+        }
+        if (res < 0) {
+            if (!bus_fault_report(command)) {
+                printf("{\"status\":\"error\",\"command\":\"romZoneSet\",\"response\":\"Error %d\"}\n", res);
+            }
+            return;
+        }
+        printf("{\"status\":\"success\",\"command\":\"romZoneSet\",\"response\":[");
+        for (int z = 0; z < ROM_ZONE_COUNT; z++) {
+            printf("%s\"0x%02X\"", z ? ", " : "", zones[z]);
+        }
+        printf("]}\n");
+    }
+    else if (strcmp(command, "romFreeze") == 0) {
+        // Permanent: locks the zone registers in their current state. Needs "data":"confirm".
+        uint32_t dev_addr = strtoul(dev_addr_str, NULL, 16);
+        if ((dev_addr & ~0x0Eu) || strcmp(data, "confirm") != 0) {
+            printf("{\"status\":\"error\",\"command\":\"romFreeze\",\"response\":\"Invalid arguments\"}\n");
+            return;
+        }
+        uint8_t value = FREEZE_DATA;
+        int res = send_cmd(DISCOVERY, 0) ? -2 : write_op(OPCODE_FREEZE_ROM | dev_addr, FREEZE_ADDR, &value, 1, NULL);
+        if (bus_fault_report(command)) {
+            return;
+        }
+        printf("{\"status\":\"%s\",\"command\":\"romFreeze\",\"response\":\"%s\"}\n",
+               res > 0 ? "success" : "error", res > 0 ? "ACK" : "NACK");
+    }
+    else if (strcmp(command, "romZoneVerify") == 0) {
+        uint32_t dev_addr = strtoul(dev_addr_str, NULL, 16);
+        rom_zone_check_t checks[ROM_ZONE_COUNT];
+        if (dev_addr & ~0x0Eu) {
+            printf("{\"status\":\"error\",\"command\":\"romZoneVerify\",\"response\":\"Error -1\"}\n");
+            return;
+        }
+        uint32_t mfr_id;
+        const eeprom_geometry_t *geo = eeprom_identify((uint8_t)dev_addr, &mfr_id);
+        if (geo == NULL) {
+            eeprom_identify_error(command, mfr_id);
+            return;
+        }
+        int res = rom_zone_verify(geo, (uint8_t)dev_addr, checks);
+        if (res < 0) {
+            if (!bus_fault_report(command)) {
+                printf("{\"status\":\"error\",\"command\":\"romZoneVerify\",\"response\":\"Error %d\"}\n", res);
+            }
+            return;
+        }
+        bool pass = true;
+        for (int z = 0; z < ROM_ZONE_COUNT; z++) {
+            pass = pass && checks[z].pass;
+        }
+        printf("{\"status\":\"%s\",\"command\":\"romZoneVerify\",\"response\":{\"pass\":%s,\"zones\":[",
+               pass ? "success" : "error", pass ? "true" : "false");
+        for (int z = 0; z < ROM_ZONE_COUNT; z++) {
+            printf("%s{\"zone\":%d,\"rom\":%s,\"nack\":%s,\"intact\":%s,\"pass\":%s}", z ? "," : "", z,
+                   checks[z].rom ? "true" : "false", checks[z].nacked ? "true" : "false",
+                   checks[z].intact ? "true" : "false", checks[z].pass ? "true" : "false");
+        }
+        printf("]}}\n");
+    }
+    else if (strcmp(command, "clockInfo") == 0) {
+        clock_check();
+        printf("{\"status\":\"%s\",\"command\":\"clockInfo\",\"response\":{\"sys_khz\":%lu,"
+               "\"measured_khz\":%lu,\"ns_per_cycle\":%.3f,\"timing_valid\":%s",
+               clock_status.error ? "error" : "success", (unsigned long)SWI_SYS_CLK_KHZ,
+               (unsigned long)clock_status.measured_khz, 1e6 / SWI_SYS_CLK_KHZ,
+               clock_status.error ? "false" : "true");
+        if (clock_status.error) {
+            printf(",\"error\":\"%s\"", clock_status.error);
+            if (clock_status.profile) {
+                printf(",\"profile\":\"%s\"", clock_status.profile);
+            }
+        }
+        printf("}}\n");
+    }
+    else if (strcmp(command, "benchmark") == 0) {
+        send_cmd(BENCHMARK, 0);
+        __dmb();
+        if (bus_fault_report(command)) {
+            return;
+        }
+        double frame_us = swi_cycles_to_us(bench_result.frame_cycles) / BENCH_FRAMES;
+        printf("{\"status\":\"success\",\"command\":\"benchmark\",\"response\":{\"arch\":\"%s\","
+               "\"sys_khz\":%lu,\"delay_cal\":%u,\"delay_ns\":{\"nominal\":%u,\"min\":%lu,\"avg\":%lu,"
+               "\"max\":%lu},\"frame\":{\"profile\":\"%s\",\"nominal_ns\":%lu,\"avg_ns\":%lu,"
+               "\"bits_per_s\":%lu}}}\n",
+               CPU_ARCH_NAME, (unsigned long)SWI_SYS_CLK_KHZ, SWI_DELAY_CAL, BENCH_DELAY_US * 1000,
+               (unsigned long)(swi_cycles_to_us(bench_result.delay_min_cycles) * 1000),
+               (unsigned long)(swi_cycles_to_us(bench_result.delay_sum_cycles / BENCH_DELAY_RUNS) * 1000),
+               (unsigned long)(swi_cycles_to_us(bench_result.delay_max_cycles) * 1000),
+               swi_profiles[core1_profile]->name, (unsigned long)(bench_result.bit_us * 1000),
+               (unsigned long)(frame_us * 1000), (unsigned long)(1e6 / frame_us));
+    }
+    else if (control_reply(command)) {
+        // Answered.
+    }
+    else if (strcmp(command, "setSpeed") == 0) {
+        uint8_t profile = 0;
+        while (profile < count_of(swi_profiles) && strcmp(data, swi_profiles[profile]->name) != 0) {
+            profile++;
+        }
+        if (profile == count_of(swi_profiles) || send_cmd(SET_PROFILE, profile) != 0x00) {
+            if (bus_fault_report(command)) {
+                return;
+            }
+            printf("{\"status\":\"error\",\"command\":\"setSpeed\",\"response\":\"Unknown speed\"}\n");
+        } else {
+            core1_profile = profile;
+            printf("{\"status\":\"success\",\"command\":\"setSpeed\",\"response\":\"%s\"}\n",
+                   swi_profiles[profile]->name);
+        }
+    }
+    else if (strcmp(command, "measureRise") == 0) {
+        uint32_t samples = count_str[0] != '\0' ? strtoul(count_str, NULL, 0) : 32;
+        if (samples == 0 || samples > 255) {
+            printf("{\"status\":\"error\",\"command\":\"measureRise\",\"response\":\"Invalid count\"}\n");
+            return;
+        }
+        send_cmd(MEASURE_RISE, (uint8_t)samples);
+        __dmb();
+        if (bus_fault_report(command)) {
+            return;
+        }
+        if (!swi_profiles[core1_profile]->tuned) {
+            tune_base = core1_profile;
+        }
+        double rise_max_us = swi_cycles_to_us(rise_result.max_cycles);
+        swi_timing_t timing = swi_timing_for_rise(&swi_profiles[tune_base]->timing, rise_max_us);
+        timing.boost_us = tune_timing.boost_us;     // Keep the pull-up assist setting.
+        bool apply = (strcmp(data, "apply") == 0);
+        if (apply) {
+            // swi_timing_for_rise() caps the sample point at the device hold time.
+            const char *error = swi_timing_check(&timing);
+            if (!error && rise_max_us * SWI_TUNE_RISE_MARGIN + SWI_TUNE_MRS_MIN_US > timing.mrs_us) {
+                error = "Rise time too slow for the device hold time";
+            }
+            if (error) {
+                printf("{\"status\":\"error\",\"command\":\"measureRise\",\"response\":\"%s\"}\n", error);
+                return;
+            }
+            uint8_t tuned = count_of(swi_profiles) - 1;
+            tune_timing = timing;
+            __dmb();
+            if (send_cmd(SET_TUNING, tuned) == 0x00) {
+                core1_profile = tuned;
+                tune_set = true;
+            } else {
+                apply = false;
+            }
+        }
+        printf("{\"status\":\"success\",\"command\":\"measureRise\",\"response\":{\"samples\":%u,"
+               "\"timeouts\":%u,\"rise_ns_min\":%lu,\"rise_ns_avg\":%lu,\"rise_ns_max\":%lu,\"base\":\"%s\","
+               "\"timing_ns\":{\"low1\":%lu,\"low0\":%lu,\"rd\":%lu,\"mrs\":%lu,\"bit\":%lu},\"applied\":%s}}\n",
+               rise_result.samples, rise_result.timeouts,
+               (unsigned long)(swi_cycles_to_us(rise_result.min_cycles) * 1000),
+               (unsigned long)(swi_cycles_to_us(rise_result.sum_cycles / rise_result.samples) * 1000),
+               (unsigned long)(rise_max_us * 1000), swi_profiles[tune_base]->name,
+               (unsigned long)(timing.low1_us * 1000), (unsigned long)(timing.low0_us * 1000),
+               (unsigned long)(timing.rd_us * 1000), (unsigned long)(timing.mrs_us * 1000),
+               (unsigned long)(timing.bit_us * 1000), apply ? "true" : "false");
+    }
+    else if (strcmp(command, "setPullupAssist") == 0) {
+        // Active pull-up pulse in ns; applied through the tuned profile, which starts from
+        // the active profile (or keeps its measured timing if it is already tuned).
+        uint32_t boost_ns = strtoul(data, NULL, 16);
+        uint8_t tuned = count_of(swi_profiles) - 1;
+        swi_timing_t timing = swi_profiles[core1_profile]->tuned ? tune_timing
+                                                                  : swi_profiles[core1_profile]->timing;
+        if (!swi_profiles[core1_profile]->tuned) {
+            tune_base = core1_profile;
+        }
+        timing.boost_us = boost_ns / 1000.0;
+        const char *error = swi_timing_check(&timing);
+        if (error) {
+            printf("{\"status\":\"error\",\"command\":\"setPullupAssist\",\"response\":\"%s\"}\n", error);
+            return;
+        }
+        tune_timing = timing;
+        __dmb();
+        if (send_cmd(SET_TUNING, tuned) != 0x00) {
+            if (!bus_fault_report(command)) {
+                printf("{\"status\":\"error\",\"command\":\"setPullupAssist\",\"response\":\"Tuning failed\"}\n");
+            }
+            return;
+        }
+        core1_profile = tuned;
+        tune_set = true;
+        printf("{\"status\":\"success\",\"command\":\"setPullupAssist\",\"response\":{\"boost_ns\":%lu,"
+               "\"profile\":\"%s\",\"base\":\"%s\"}}\n", (unsigned long)boost_ns, swi_profiles[tuned]->name,
+               swi_profiles[tune_base]->name);
+    }
+    else if (strcmp(command, "setTrace") == 0) {
+        unsigned int temp_val = 1;
+        if (strlen(data) > 0) {
+            sscanf(data, "0x%x", &temp_val);
+        }
+        session.trace = (temp_val != 0);
+        printf("{\"status\":\"success\",\"command\":\"setTrace\",\"response\":\"%s\"}\n",
+               session.trace ? "ON" : "OFF");
+    }
+    else if (strcmp(command, "setEcho") == 0) {
+        unsigned int temp_val = 1;
+        if (strlen(data) > 0) {
+            sscanf(data, "0x%x", &temp_val);
+        }
+        session.echo = (temp_val != 0);
+        printf("{\"status\":\"success\",\"command\":\"setEcho\",\"response\":\"%s\"}\n",
+               session.echo ? "ON" : "OFF");
+    }
+    else {
+        printf("{\"status\":\"error\",\"command\":\"unknown\",\"response\":\"Invalid Command\"}\n");
+    }
+}
+
+// Binary protocol carried on the vendor bulk interface.
+// Request:  [op][len_lo][len_hi][payload...]
+// Response: [op][status][len_lo][len_hi][payload...]
+#define BIN_HDR_REQ         3
+#define BIN_HDR_RESP        4
+#define BIN_MAX_PAYLOAD     256
+
+#define BIN_OP_LOOPBACK     0x00    /* Echo the payload back (link test, no bus access). */
+#define BIN_OP_DISCOVERY    0x01    /* -> [ack] */
+#define BIN_OP_TX_BYTE      0x02    /* [byte] -> [ack] */
+#define BIN_OP_RX_BYTE      0x03    /* [ack] -> [byte] */
+#define BIN_OP_MFR_ID       0x04    /* [dev_addr] -> [id2][id1][id0] */
+#define BIN_OP_READ_BLOCK   0x05    /* [dev_addr][start_addr][len] -> raw bytes */
+#define BIN_OP_WAVEFORM     0x06    /* [word0 LE][word1 LE]... -> [wf status][n_lo][n_hi][timeouts_lo][timeouts_hi][samples] */
+#define BIN_OP_SYNC         0x07    /* -> [time_us_64 LE, 8 bytes] */
+
+#define BIN_STATUS_OK           0x00
+#define BIN_STATUS_BAD_OP       0x01
+#define BIN_STATUS_BAD_LENGTH   0x02
+#define BIN_STATUS_BUS_ERROR    0x03
+#define BIN_STATUS_BUS_FAULT    0x04    /* Line stuck low or Core1 timeout (see bus_fault). */
+#define BIN_STATUS_CANCELLED    0x05    /* Stopped by a cancel request. */
+
+// Frame being assembled from the vendor OUT endpoint.
+static uint8_t bin_rx[BIN_HDR_REQ + BIN_MAX_PAYLOAD];
+static uint32_t bin_rx_len;
+
+/**
+ * @brief Writes one binary response frame to the vendor IN endpoint.
  *
- * This helper function checks if the provided token (obtained using jsmn) is a string
- * that exactly matches the given null-terminated string.
- *
- * @param json The entire JSON string.
- * @param tok  The token to compare.
- * @param s    The null-terminated string to compare against.
- * @return 0 if the token matches the string; otherwise, -1.
+ * usb_vendor_process() only dispatches a request when the vendor TX FIFO can
+ * hold a full frame, so this never waits on the host.
  */
-int jsoneq(const char *json, jsmntok_t *tok, const char *s) {
-    if (tok->type == JSMN_STRING &&
-        (int)strlen(s) == tok->end - tok->start &&
-        strncmp(json + tok->start, s, tok->end - tok->start) == 0) {
-        return 0;
+static void bin_respond(uint8_t op, uint8_t status, const uint8_t *payload, uint16_t len) {
+    if (bus_fault != BUS_FAULT_NONE) {
+        status = (bus_fault == BUS_FAULT_CANCELLED) ? BIN_STATUS_CANCELLED : BIN_STATUS_BUS_FAULT;
+        len = 0;
     }
-    return -1;
+    uint8_t hdr[BIN_HDR_RESP] = { op, status, (uint8_t)(len & 0xFF), (uint8_t)(len >> 8) };
+    tud_vendor_write(hdr, sizeof(hdr));
+    if (len > 0) {
+        tud_vendor_write(payload, len);
+    }
+    tud_vendor_write_flush();
 }
 
 /**
- * @brief Parses a JSON string using jsmn and dispatches commands.
- *
- * Extracts the "command", "data", "dev_addr", "start_addr", and "len" fields from the JSON string.
- * For the "readBlock" command, it uses dev_addr, start_addr, and len fields to specify the EEPROM block
- * to read. Other commands are dispatched as before. Responses are printed in JSON format.
+ * @brief Executes one binary request and sends its response.
  *
- * @param json_str The JSON command string.
+ * @param op      Request opcode (BIN_OP_*).
+ * @param payload Request payload.
+ * @param len     Payload length in bytes.
  */
-void handle_command(char *json_str) {
-    jsmn_parser parser;
-    jsmntok_t tokens[30];  // Increased token count to accommodate additional fields.
-    jsmn_init(&parser);
-    int token_count = jsmn_parse(&parser, json_str, strlen(json_str), tokens, 30);
-    if (token_count < 0) {
-        printf("{\"status\":\"error\",\"command\":\"parse\",\"response\":\"Failed to parse JSON\"}\n");
-        return;
-    }
-    if (token_count < 1 || tokens[0].type != JSMN_OBJECT) {
-        printf("{\"status\":\"error\",\"command\":\"parse\",\"response\":\"JSON object expected\"}\n");
-        return;
-    }
-    
-    char command[64] = {0};
-    char data[64] = {0};
-    char dev_addr_str[32] = {0};
-    char start_addr_str[32] = {0};
-    char len_str[32] = {0};
-    
-    // Iterate over tokens to extract expected fields.
-    for (int i = 1; i < token_count; i++) {
-        if (jsoneq(json_str, &tokens[i], "command") == 0) {
-            int length = tokens[i + 1].end - tokens[i + 1].start;
-            if (length < (int)sizeof(command)) {
-                strncpy(command, json_str + tokens[i + 1].start, length);
-                command[length] = '\0';
+static void handle_bin_command(uint8_t op, const uint8_t *payload, uint16_t len) {
+    static uint8_t out[BIN_MAX_PAYLOAD];
+
+    bus_fault_clear();
+    switch (op) {
+        case BIN_OP_LOOPBACK:
+            bin_respond(op, BIN_STATUS_OK, payload, len);
+            break;
+        case BIN_OP_DISCOVERY:
+            out[0] = send_cmd(DISCOVERY, 0);
+            bin_respond(op, BIN_STATUS_OK, out, 1);
+            break;
+        case BIN_OP_TX_BYTE:
+            if (len != 1) {
+                bin_respond(op, BIN_STATUS_BAD_LENGTH, NULL, 0);
+                break;
             }
-            i++; // Skip value token.
+            out[0] = send_cmd(TX_BYTE, payload[0]);
+            bin_respond(op, BIN_STATUS_OK, out, 1);
+            break;
+        case BIN_OP_RX_BYTE:
+            out[0] = send_cmd(RX_BYTE, (len > 0) ? payload[0] : SEND_NACK);
+            bin_respond(op, BIN_STATUS_OK, out, 1);
+            break;
+        case BIN_OP_MFR_ID: {
+            uint32_t id = read_mfr_id((len > 0) ? payload[0] : 0);
+            out[0] = (uint8_t)(id >> 16);
+            out[1] = (uint8_t)(id >> 8);
+            out[2] = (uint8_t)id;
+            bin_respond(op, id ? BIN_STATUS_OK : BIN_STATUS_BUS_ERROR, out, 3);
+            break;
         }
-        else if (jsoneq(json_str, &tokens[i], "data") == 0) {
-            int length = tokens[i + 1].end - tokens[i + 1].start;
-            if (length < (int)sizeof(data)) {
-                strncpy(data, json_str + tokens[i + 1].start, length);
-                data[length] = '\0';
+        case BIN_OP_READ_BLOCK: {
+            if (len != 3 || payload[2] == 0 || payload[1] >= EEPROM_MAX_SIZE ||
+                payload[2] > EEPROM_MAX_SIZE - payload[1]) {
+                bin_respond(op, BIN_STATUS_BAD_LENGTH, NULL, 0);
+                break;
             }
-            i++; // Skip value token.
-        }
-        else if (jsoneq(json_str, &tokens[i], "dev_addr") == 0) {
-            int length = tokens[i + 1].end - tokens[i + 1].start;
-            if (length < (int)sizeof(dev_addr_str)) {
-                strncpy(dev_addr_str, json_str + tokens[i + 1].start, length);
-                dev_addr_str[length] = '\0';
+            const eeprom_geometry_t *geo = eeprom_identify(payload[0], NULL);
+            if (geo == NULL) {
+                bin_respond(op, BIN_STATUS_BUS_ERROR, NULL, 0);
+                break;
             }
-            i++; // Skip value token.
+            if (!eeprom_range_ok(geo, payload[1], payload[2])) {
+                bin_respond(op, BIN_STATUS_BAD_LENGTH, NULL, 0);
+                break;
+            }
+            if (read_block(payload[0], payload[1], out, payload[2], NULL) < 0) {
+                bin_respond(op, BIN_STATUS_BUS_ERROR, NULL, 0);
+            } else {
+                bin_respond(op, BIN_STATUS_OK, out, payload[2]);
+            }
+            break;
         }
-        else if (jsoneq(json_str, &tokens[i], "start_addr") == 0) {
-            int length = tokens[i + 1].end - tokens[i + 1].start;
-            if (length < (int)sizeof(start_addr_str)) {
-                strncpy(start_addr_str, json_str + tokens[i + 1].start, length);
-                start_addr_str[length] = '\0';
+        case BIN_OP_WAVEFORM: {
+            if (len == 0 || len % 4 != 0 || len / 4 > WF_MAX_WORDS) {
+                bin_respond(op, BIN_STATUS_BAD_LENGTH, NULL, 0);
+                break;
             }
-            i++; // Skip value token.
+            wf_program_len = len / 4;
+            for (uint32_t i = 0; i < wf_program_len; i++) {
+                wf_program[i] = payload[4 * i] | (payload[4 * i + 1] << 8) |
+                                (payload[4 * i + 2] << 16) | ((uint32_t)payload[4 * i + 3] << 24);
+            }
+            if (wf_validate(wf_program, wf_program_len)) {
+                bin_respond(op, BIN_STATUS_BAD_OP, NULL, 0);
+                break;
+            }
+            out[0] = wf_execute();
+            out[1] = (uint8_t)wf_result.sample_count;
+            out[2] = (uint8_t)(wf_result.sample_count >> 8);
+            out[3] = (uint8_t)wf_result.timeouts;
+            out[4] = (uint8_t)(wf_result.timeouts >> 8);
+            uint16_t sample_bytes = (wf_result.sample_count + 7) / 8;
+            memcpy(&out[5], wf_result.samples, sample_bytes);
+            bin_respond(op, BIN_STATUS_OK, out, 5 + sample_bytes);
+            break;
         }
-        else if (jsoneq(json_str, &tokens[i], "len") == 0) {
-            int length = tokens[i + 1].end - tokens[i + 1].start;
-            if (length < (int)sizeof(len_str)) {
-                strncpy(len_str, json_str + tokens[i + 1].start, length);
-                len_str[length] = '\0';
+        case BIN_OP_SYNC: {
+            uint64_t now_us = time_us_64();
+            for (int i = 0; i < 8; i++) {
+                out[i] = (uint8_t)(now_us >> (8 * i));
             }
-            i++; // Skip value token.
+            bin_respond(op, BIN_STATUS_OK, out, 8);
+            break;
         }
+        default:
+            bin_respond(op, BIN_STATUS_BAD_OP, NULL, 0);
+            break;
     }
-    
-    // Dispatch commands based on the parsed "command" field.
-    if (strcmp(command, "discoveryResponse") == 0) {
-        uint8_t ack = send_cmd(DISCOVERY, 0);
-        const char *status_str = (ack == 0x00) ? "ACK" : "NACK";
-        printf("{\"status\":\"success\",\"command\":\"discoveryResponse\",\"response\":\"%s\"}\n", status_str);
+}
+
+/**
+ * @brief Reassembles binary frames from the vendor OUT endpoint and dispatches them.
+ *
+ * A frame with an oversized length field cannot be resynchronized, so it is
+ * answered with BIN_STATUS_BAD_LENGTH and everything received so far is dropped.
+ */
+static void usb_vendor_process(void) {
+    if (!tud_vendor_mounted()) {
+        bin_rx_len = 0;
+        return;
     }
-    else if (strcmp(command, "txByte") == 0) {
-        uint8_t data_val = 0;
-        unsigned int temp_val = 0;
-        if (strlen(data) > 0) {
-            if (sscanf(data, "0x%x", &temp_val) == 1) {
-                data_val = (uint8_t)temp_val;
-            }
+    while (true) {
+        if (bin_rx_len < sizeof(bin_rx) && tud_vendor_available()) {
+            bin_rx_len += tud_vendor_read(&bin_rx[bin_rx_len], sizeof(bin_rx) - bin_rx_len);
         }
-        uint8_t ack = send_cmd(TX_BYTE, data_val);  
-        const char *ack_str = (ack == 0x00) ? "ACK" : "NACK";
-        printf("{\"status\":\"success\",\"command\":\"txByte\",\"response\":\"%s\"}\n", ack_str);
+        if (bin_rx_len < BIN_HDR_REQ) {
+            return;
+        }
+        uint16_t len = (uint16_t)(bin_rx[1] | (bin_rx[2] << 8));
+        if (len > BIN_MAX_PAYLOAD) {
+            bin_respond(bin_rx[0], BIN_STATUS_BAD_LENGTH, NULL, 0);
+            bin_rx_len = 0;
+            return;
+        }
+        uint32_t frame_len = BIN_HDR_REQ + len;
+        if (bin_rx_len < frame_len) {
+            return;
+        }
+        // Backpressure: leave the request queued until a full response fits.
+        if (tud_vendor_write_available() < BIN_HDR_RESP + BIN_MAX_PAYLOAD) {
+            return;
+        }
+        stats.commands++;
+        handle_bin_command(bin_rx[0], &bin_rx[BIN_HDR_REQ], len);
+        bin_rx_len -= frame_len;
+        memmove(bin_rx, &bin_rx[frame_len], bin_rx_len);
     }
-    else if (strcmp(command, "rxByte") == 0) {
-        uint8_t received = send_cmd(RX_BYTE, 0);  
-        printf("{\"status\":\"success\",\"command\":\"rxByte\",\"response\":\"0x%02X\"}\n", received);
+}
+
+// Receive ring buffer filled in bulk from the CDC FIFO. The indexes are free running.
+static uint8_t rx_ring[RX_RING_SIZE];
+static uint32_t rx_head;
+static uint32_t rx_tail;
+
+// Time of the last bulk read, taken as the arrival time of the lines it completed.
+static uint32_t rx_stamp_us;
+
+// Command line being assembled from the ring.
+static char line_buffer[BUFFER_SIZE];
+static int line_len;
+static bool line_ready;             ///< line_buffer holds a complete line waiting for its lane.
+static uint32_t line_arrival_us;
+static bool rx_processing;          ///< usb_rx_process() is running (it is not reentrant).
+
+// Commands answered in the control lane. Anything else, and any scheduled command, is bus work.
+static const char *const control_commands[] = { "ping", "stats", "sync", "setTrace", "cancel" };
+
+/**
+ * @brief Returns the lane of a command line.
+ *
+ * @param name Receives the command name (empty if the line does not parse).
+ */
+static int command_lane(const char *line, char *name, size_t name_size) {
+    jsmn_parser parser;
+    jsmntok_t tokens[30];
+    bool scheduled = false;
+
+    name[0] = '\0';
+    jsmn_init(&parser);
+    int token_count = jsmn_parse(&parser, line, strlen(line), tokens, 30);
+    for (int i = 1; i + 1 < token_count; i += 2) {
+        int length = tokens[i + 1].end - tokens[i + 1].start;
+        if (jsoneq(line, &tokens[i], "command") == 0 && length < (int)name_size) {
+            strncpy(name, line + tokens[i + 1].start, length);
+            name[length] = '\0';
+        } else if (jsoneq(line, &tokens[i], "at_us") == 0 || jsoneq(line, &tokens[i], "period_us") == 0) {
+            scheduled = true;
+        }
     }
-    else if (strcmp(command, "manufacturerId") == 0) {
-        uint8_t dev_addr = 0;
-        unsigned int temp_val = 0;
-        if (strlen(dev_addr_str) > 0) {
-            if (sscanf(dev_addr_str, "0x%x", &temp_val) == 1) {
-                dev_addr = (uint8_t)temp_val;
+    // While a macro is recorded, lines must reach it in order. A cancel is never queued.
+    if (strcmp(name, "cancel") == 0) {
+        return LANE_CONTROL;
+    }
+    if (scheduled || macro_state.recording) {
+        return LANE_BUS;
+    }
+    for (size_t i = 0; i < sizeof(control_commands) / sizeof(control_commands[0]); i++) {
+        if (strcmp(name, control_commands[i]) == 0) {
+            return LANE_CONTROL;
+        }
+    }
+    return LANE_BUS;
+}
+
+/**
+ * @brief Accounts the queueing delay of a command starting in a lane.
+ */
+static void lane_started(int lane, uint32_t arrival_us) {
+    lane_stats_t *ls = &stats.lanes[lane];
+    ls->commands++;
+    ls->wait_last_us = time_us_32() - arrival_us;
+    ls->wait_max_us = MAX(ls->wait_max_us, ls->wait_last_us);
+}
+
+/**
+ * @brief Runs a command line and starts its latency measurement.
+ *
+ * Rejects it instead if the output queue cannot hold a full response.
+ */
+static void command_execute(char *line, uint32_t arrival_us, int lane) {
+    if (out_queue_free(&console_queue) < TX_RESERVE) {
+        stats.busy_rejects++;
+        printf("{\"status\":\"error\",\"command\":\"busy\",\"response\":\"Output queue full\"}\n");
+    } else {
+        stats.commands++;
+        lane_started(lane, arrival_us);
+        handle_command(line);
+    }
+    latency_start_us = arrival_us;
+    latency_pending = true;
+}
+
+/**
+ * @brief Hands the complete line in line_buffer to its lane.
+ *
+ * Control commands run at once. Bus commands are queued for bus_queue_dispatch().
+ *
+ * A control command arriving during a bus command, or while any Core1 transaction is
+ * outstanding (soak, watch and vendor requests included), runs nested inside a
+ * usb_service() call. It is answered by control_reply() alone, never by handle_command(),
+ * so it cannot clear the outer bus fault or touch the outer frame's parsed fields, and
+ * the nesting adds one small frame (usb_rx_process() does not re-enter). The outer work
+ * keeps its reserved output space and its latency measurement. "setTrace" takes an
+ * argument and waits until the outer work is done.
+ *
+ * @return false if the line has to wait (bus queue full, no room for a nested response,
+ *         or a control command that cannot run nested).
+ */
+static bool lane_dispatch(void) {
+    char name[16];
+    int lane = command_lane(line_buffer, name, sizeof(name));
+
+    if (lane == LANE_BUS) {
+        if (bus_queue_head - bus_queue_tail == BUS_QUEUE_DEPTH) {
+            return false;
+        }
+        queued_cmd_t *q = &bus_queue[bus_queue_head % BUS_QUEUE_DEPTH];
+        memcpy(q->line, line_buffer, (size_t)line_len + 1);
+        q->arrival_us = line_arrival_us;
+        bus_queue_head++;
+        return true;
+    }
+    if (strcmp(name, "cancel") == 0 && cancel_skipped != cancel_seen) {
+        cancel_skipped++;
+        return true;    // Already acted on by cancel_scan(); cancel_finish() answers it.
+    }
+    if (!bus_running && !core1_busy) {
+        command_execute(line_buffer, line_arrival_us, LANE_CONTROL);
+        return true;
+    }
+    if (strcmp(name, "setTrace") == 0 || out_queue_free(&console_queue) < 2 * TX_RESERVE) {
+        return false;
+    }
+    uint32_t start_us = latency_start_us;
+    bool pending = latency_pending;
+    stats.commands++;
+    lane_started(LANE_CONTROL, line_arrival_us);
+    control_reply(name);
+    latency_start_us = start_us;
+    latency_pending = pending;
+    return true;
+}
+
+/**
+ * @brief Runs the oldest queued bus command, if any. Called from the event loop only.
+ */
+static void bus_queue_dispatch(void) {
+    if (bus_queue_tail == bus_queue_head) {
+        return;
+    }
+    queued_cmd_t *q = &bus_queue[bus_queue_tail % BUS_QUEUE_DEPTH];
+    bus_running = true;
+    command_execute(q->line, q->arrival_us, LANE_BUS);
+    bus_running = false;
+    bus_queue_tail++;
+}
+
+// Lines assembled by cancel_scan() ahead of usb_rx_process(), truncated the same way as
+// line_buffer, so both see the same command names.
+static uint32_t cancel_scan_pos;    ///< Ring index scanned so far (free running).
+static char cancel_scan_line[BUFFER_SIZE];
+static int cancel_scan_len;
+
+/**
+ * @brief Looks for cancel requests in the bytes just added to the receive ring.
+ *
+ * Runs on every bulk read, including those made by usb_service() while a command
+ * is executing, so a cancel takes effect without waiting for its turn in the ring.
+ * Each complete line is parsed like the lane dispatcher does (command_lane()), so any
+ * key order or spacing is recognized and only the exact "cancel" command matches.
+ */
+static void cancel_scan(void) {
+    for (; cancel_scan_pos != rx_head; cancel_scan_pos++) {
+        char c = (char)rx_ring[cancel_scan_pos & RX_RING_MASK];
+        if (c == CANCEL_BYTE) {
+            cancel_pending = true;
+        } else if (c != '\n' && c != '\r') {
+            if (cancel_scan_len < BUFFER_SIZE - 1) {
+                cancel_scan_line[cancel_scan_len++] = c;
+            }
+        } else if (cancel_scan_len > 0) {
+            char name[16];
+            cancel_scan_line[cancel_scan_len] = '\0';
+            cancel_scan_len = 0;
+            command_lane(cancel_scan_line, name, sizeof(name));
+            if (strcmp(name, "cancel") == 0) {
+                cancel_pending = true;
+                cancel_lines++;
+                cancel_seen++;
             }
         }
-        uint32_t received = read_mfr_id(dev_addr);  
-        /* If the manufacturer ID equals zero, that is considered an error. */
-        if (received == 0) {
-            printf("{\"status\":\"error\",\"command\":\"manufacturerId\",\"response\":\"Error: Manufacturer ID is zero\"}\n");
-        } else {
-            printf("{\"status\":\"success\",\"command\":\"manufacturerId\",\"response\":\"0x%08X\"}\n", received);
+    }
+}
+
+/**
+ * @brief Drains the CDC RX FIFO into the receive ring with bulk reads.
+ *
+ * Reads straight into the ring storage, at most two calls per pass
+ * (one per contiguous region).
+ */
+static void usb_rx_fill(void) {
+    while (tud_cdc_available()) {
+        uint32_t free_bytes = RX_RING_SIZE - (rx_head - rx_tail);
+        if (free_bytes == 0) {
+            break;  // Leave the rest in the FIFO; the host is NAKed until we catch up.
+        }
+        uint32_t idx = rx_head & RX_RING_MASK;
+        uint32_t span = MIN(free_bytes, RX_RING_SIZE - idx);
+        uint32_t count = tud_cdc_read(&rx_ring[idx], span);
+        if (count == 0) {
+            break;
         }
+        rx_head += count;
+        rx_stamp_us = time_us_32();
     }
-    else if (strcmp(command, "readBlock") == 0) {
-        // Use parsed values from additional fields; if not provided, use defaults.
-        unsigned int dev_addr = 0;
-        unsigned int start_addr = 0;
-        unsigned int block_len = 10;  // default length
+    cancel_scan();
+}
 
-        if (strlen(dev_addr_str) > 0) {
-            sscanf(dev_addr_str, "0x%x", &dev_addr);
+/**
+ * @brief Scans the receive ring for line terminators and dispatches complete commands.
+ *
+ * Each contiguous chunk up to (and including) a terminator is copied into the
+ * line buffer and, when echo is enabled, written back in a single call.
+ * Lines longer than BUFFER_SIZE - 1 are truncated, as before. CANCEL_BYTE is
+ * dropped from the line. Complete lines go to their lane (lane_dispatch()).
+ */
+static void usb_rx_process(void) {
+    if (rx_processing) {
+        return;
+    }
+    rx_processing = true;
+    while (true) {
+        if (line_ready) {
+            if (!lane_dispatch()) {
+                break;  // Retried on the next pass; the rest of the ring waits behind it.
+            }
+            line_ready = false;
+            line_len = 0;
         }
-        if (strlen(start_addr_str) > 0) {
-            sscanf(start_addr_str, "0x%x", &start_addr);
+        if (rx_tail == rx_head) {
+            break;
         }
-        if (strlen(len_str) > 0) {
-            sscanf(len_str, "0x%x", &block_len);
+        uint32_t idx = rx_tail & RX_RING_MASK;
+        uint32_t span = MIN(rx_head - rx_tail, RX_RING_SIZE - idx);
+        const char *chunk = (const char *)&rx_ring[idx];
+        uint32_t n = 0;
+
+        while (n < span && chunk[n] != '\n' && chunk[n] != '\r' && chunk[n] != CANCEL_BYTE) {
+            n++;
         }
-        
-        // Allocate buffer based on block length.
-        uint8_t *read_buffer = malloc(block_len);
-        if (!read_buffer) {
-            printf("{\"status\":\"error\",\"command\":\"readBlock\",\"response\":\"Memory allocation error\"}\n");
-            return;
+        bool terminated = (n < span && chunk[n] != CANCEL_BYTE);
+        bool control = (n < span && chunk[n] == CANCEL_BYTE);  // Already acted on by cancel_scan().
+
+        if (session.echo) {
+            out_queue_put(&console_queue, chunk, terminated ? n + 1 : n);
         }
-        
-        int result = read_block((uint8_t)dev_addr, (uint8_t)start_addr, read_buffer, (uint8_t)block_len);
-        if (result < 0) {
-            printf("{\"status\":\"error\",\"command\":\"readBlock\",\"response\":\"Error %d\"}\n", result);
-        } else {
-            // Build a JSON array with the values, inserting a newline after every 8 entries.
-		    printf("{\"status\":\"success\",\"command\":\"readBlock\",\"response\":[\n");
-		    for (unsigned int i = 0; i < block_len; i++) {
-		        printf("\"0x%02X\"", read_buffer[i]);
-		        if (i < block_len - 1) {
-		            // Insert a comma after each value.
-		            if ((i + 1) % 8 == 0) {
-		                // After every 8 values, print a newline.
-		                printf(",\n");
-		            } else {
-		                printf(", ");
-		            }
-		        }
-		    }
-		    printf("\n]}\n");
+
+        uint32_t copy = MIN(n, (uint32_t)(BUFFER_SIZE - 1 - line_len));
+        memcpy(&line_buffer[line_len], chunk, copy);
+        line_len += (int)copy;
+        rx_tail += (terminated || control) ? n + 1 : n;
+
+        if (terminated && line_len > 0) {
+            line_buffer[line_len] = '\0';
+            line_arrival_us = rx_stamp_us;
+            line_ready = true;
         }
-        free(read_buffer);
-    }
-    else {
-        printf("{\"status\":\"error\",\"command\":\"unknown\",\"response\":\"Invalid Command\"}\n");
     }
+    rx_processing = false;
+}
+
+/**
+ * @brief Repeating timer callback: toggles the LED as a heartbeat.
+ */
+static bool heartbeat_cb(repeating_timer_t *rt) {
+    (void)rt;
+    gpio_xor_mask(1 << LED_PIN);
+    return true;
 }
 
 /**
  * @brief Main entry point.
  *
- * Initializes STDIO and the onboard LED. Waits for USB connection before displaying
- * the splash message, then launches Core1 for timing-critical operations. The main loop
- * reads JSON commands from USB serial, dispatches them, and toggles the LED as an activity indicator.
+ * Initializes TinyUSB, the CDC stdio driver and the onboard LED. Waits for USB connection
+ * before displaying the splash message, then launches Core1 for timing-critical operations.
+ *
+ * Core0 then runs an event loop: the USB controller interrupt (serviced by tud_task(), which
+ * flags received data through tud_cdc_rx_cb()), the Core1 completion doorbell (SIO FIFO IRQ)
+ * and the heartbeat timer all wake it from __wfe(). There is no polling timeout.
  *
  * @return int 0 on exit.
  */
 int main(void) {
-    stdio_init_all();
-    char buffer[BUFFER_SIZE];
-    int index = 0;
+    repeating_timer_t heartbeat;
+
+    // Core0 also runs bus delays (stop_con(), read_eeprom()); Core1 starts its own counter
+    // in swi_bus_init().
+    swi_cycle_counter_init();
+    clock_setup();
+    tusb_init();
+    stdio_set_driver_enabled(&cdc_stdio_driver, true);
+
+    // Any interrupt becoming pending sets the event register, so __wfe() cannot miss it.
+#if !PICO_RISCV
+    scb_hw->scr |= SCB_SCR_SEVONPEND_BITS;
+#endif
 
     // Initialize the onboard LED.
     gpio_init(LED_PIN);
     gpio_set_dir(LED_PIN, GPIO_OUT);
     
-    // Wait for USB to be connected before printing the splash message.
-    while (!stdio_usb_connected()) {
-        sleep_ms(100);
-        gpio_xor_mask(1 << LED_PIN);
+    // Wait for USB to be connected before printing the splash message (fast blink).
+    add_repeating_timer_ms(100, heartbeat_cb, NULL, &heartbeat);
+    while (!tud_cdc_connected()) {
+        tud_task();
+        core0_idle();
     }
+    cancel_repeating_timer(&heartbeat);
 
     // Splash message indicating the tool is ready.
     printf("\n"
@@ -738,31 +3666,50 @@ int main(void) {
            "*  Inject commands via USB serial to     *\n"
            "*  emulate and test AT21CS11 EEPROMs.    *\n"
            "******************************************\n\n");
+    clock_check();
+    if (clock_status.error) {
+        printf("WARNING: %s (%lu kHz configured, %lu kHz measured). Bus timing is not valid.\n\n",
+               clock_status.error, (unsigned long)SWI_SYS_CLK_KHZ, (unsigned long)clock_status.measured_khz);
+    }
+    if (!macro_flash_free()) {
+        printf("WARNING: The firmware image reaches into the macro flash area. Macros cannot be stored.\n\n");
+    }
 
-    // Launch Core1 for timing-critical bit-banging.
+    // Launch Core1 for timing-critical bit-banging. The launch handshake uses the
+    // FIFO, so the doorbell is only installed afterwards.
     multicore_launch_core1(core1_entry);
-    
-    // Main loop: read JSON commands from USB serial and process them,
-    // while toggling the LED to indicate activity.
+    multicore_fifo_clear_irq();
+    irq_set_exclusive_handler(SIO_FIFO_IRQ_NUM(0), core1_doorbell_isr);
+    irq_set_enabled(SIO_FIFO_IRQ_NUM(0), true);
+
+    // Heartbeat while idle.
+    add_repeating_timer_ms(250, heartbeat_cb, NULL, &heartbeat);
+
+    // Event loop: service USB, process received commands, then sleep until the next interrupt.
+    usb_rx_pending = true;
     while (true) {
-        int ch = getchar_timeout_us(250000);
-        if (ch != PICO_ERROR_TIMEOUT) {
-            putchar(ch);  // Optionally echo received characters.
-            if (ch == '\n' || ch == '\r') {
-                buffer[index] = '\0';
-                if (index > 0) {
-                    handle_command(buffer);
-                    index = 0;
-                }
+        usb_service();
+        if (usb_rx_pending) {
+            usb_rx_pending = false;
+            do {
+                usb_rx_fill();
+                usb_rx_process();
+            } while (tud_cdc_available());
+        }
+        cancel_finish();
+        bus_queue_dispatch();
+        usb_vendor_process();
+        watch_service();
+        soak_service();
+        // Data flagged while a command was running is handled before sleeping.
+        // A running soak test or queued bus work keeps the loop going.
+        if (!usb_rx_pending && !soak.active && bus_queue_tail == bus_queue_head) {
+            if (watch.active) {
+                core0_idle_until(from_us_since_boot(watch.next_us));
             } else {
-                if (index < BUFFER_SIZE - 1) {
-                    buffer[index++] = (char)ch;
-                }
+                core0_idle();
             }
         }
-        // Toggle the LED as a live indicator.
-        gpio_xor_mask(1 << LED_PIN);
     }
     return 0;
 }
-
@@ -0,0 +1,255 @@
+#!/usr/bin/env python3
+"""
+Build-time memory report for the PicoSWITool firmware.
+
+Reads the GCC call graphs (-fcallgraph-info=su) produced next to the object
+files and the linked ELF, and prints:
+  - static RAM (.data + .bss) and the largest static objects;
+  - the worst-case stack depth and call chain of each Core0 and Core1 root.
+
+Callees without call-graph information (precompiled newlib code, assembly)
+count as 0 bytes and are listed, so the figures are lower bounds for chains
+that go through them. Indirect calls are listed the same way.
+
+Recursive calls are followed up to the nesting limit the firmware enforces
+(RECURSION_LIMITS). Recursion without a known limit cannot be bounded; it is
+listed and reported as a warning.
+
+Author: jjsch-dev
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+# Entry points per core. Interrupt handlers run on Core0's stack, on top of main():
+# the Core1 doorbell, the TinyUSB device IRQ and the SDK timer (alarm) IRQ.
+CORE0_ROOTS = ["main"]
+CORE0_IRQ_ROOTS = ["core1_doorbell_isr", "dcd_rp2040_irq", "hardware_alarm_irq_handler",
+                   "alarm_pool_irq_handler"]
+CORE1_ROOTS = ["core1_entry"]
+
+# Calls made through function pointers that the call graph cannot see.
+# The repeating timer callback runs inside the timer IRQ.
+INDIRECT_CALLS = {
+    "hardware_alarm_irq_handler": ["heartbeat_cb"],
+    "alarm_pool_irq_handler": ["heartbeat_cb"],
+}
+
+# Most frames of a function on one chain, as the firmware limits its re-entry.
+# Received lines are dispatched from usb_service() while a command waits, so the
+# USB path and the command path call each other:
+#  - usb_rx_process() does not re-enter (rx_processing), and command_execute() only
+#    runs from the event loop or the outermost usb_rx_process(); control lines
+#    arriving meanwhile are answered by control_reply(). A "sync" services USB once
+#    more, and one run from a macro or schedule can have a nested control line
+#    answered inside it (two frames each of control_reply() and usb_service()).
+#  - handle_command() nests through schedule_run() and macro_run(): a scheduled "run",
+#    or a macro line with "at_us", reaches three frames. Schedules and macros do not
+#    nest further.
+RECURSION_LIMITS = {
+    "usb_rx_process": 1,
+    "command_execute": 1,
+    "usb_service": 2,
+    "control_reply": 2,
+    "handle_command": 3,
+    "schedule_run": 1,
+    "macro_run": 1,
+}
+
+NODE_RE = re.compile(r'node:\s*\{\s*title:\s*"([^"]+)"\s*label:\s*"([^"]*)"')
+EDGE_RE = re.compile(r'edge:\s*\{\s*sourcename:\s*"([^"]+)"\s*targetname:\s*"([^"]+)"')
+STACK_RE = re.compile(r'\\n(\d+) bytes \(([^)]*)\)')
+
+
+def load_callgraph(root_dir):
+    """Collects stack usage and call edges from every .ci file below root_dir."""
+    stack = {}
+    kinds = {}
+    edges = {}
+    for dirpath, _, files in os.walk(root_dir):
+        for name in files:
+            if not name.endswith(".ci"):
+                continue
+            with open(os.path.join(dirpath, name), encoding="utf-8", errors="replace") as f:
+                text = f.read()
+            for title, label in NODE_RE.findall(text):
+                m = STACK_RE.search(label)
+                if m:
+                    stack[title] = max(stack.get(title, 0), int(m.group(1)))
+                    kinds[title] = m.group(2)
+            for src, dst in EDGE_RE.findall(text):
+                edges.setdefault(src, set()).add(dst)
+    for src, targets in INDIRECT_CALLS.items():
+        src = find_node(src, stack)
+        for dst in targets:
+            dst = find_node(dst, stack)
+            if src and dst:
+                edges.setdefault(src, set()).add(dst)
+    return stack, kinds, edges
+
+
+def cyclic_nodes(edges):
+    """Returns the functions that lie on a call cycle (Tarjan's strongly connected components).
+
+    Only their deepest chain depends on the path that reached them, so every other
+    result can be memoized.
+    """
+    index = {}
+    lowlink = {}
+    stack = []
+    on_stack = set()
+    cyclic = set()
+
+    def visit(node):
+        index[node] = lowlink[node] = len(index)
+        stack.append(node)
+        on_stack.add(node)
+        for callee in edges.get(node, ()):
+            if callee not in index:
+                visit(callee)
+                lowlink[node] = min(lowlink[node], lowlink[callee])
+            elif callee in on_stack:
+                lowlink[node] = min(lowlink[node], index[callee])
+        if lowlink[node] == index[node]:
+            component = []
+            while True:
+                member = stack.pop()
+                on_stack.discard(member)
+                component.append(member)
+                if member == node:
+                    break
+            if len(component) > 1 or node in edges.get(node, ()):
+                cyclic.update(component)
+
+    for node in list(edges):
+        if node not in index:
+            visit(node)
+    return cyclic
+
+
+def worst_path(func, stack, edges, cyclic, unresolved, unbounded, memo, path):
+    """Returns (bytes, chain) of the deepest call chain starting at func.
+
+    path lists the functions above func on the current chain; a recursive call
+    is followed while the function has fewer than its RECURSION_LIMITS frames on it.
+    """
+    if func in memo:
+        return memo[func]
+    if func in path:
+        limit = RECURSION_LIMITS.get(short_name(func))
+        if limit is None:
+            unbounded.add(func)
+            return 0, [func + " (recursion)"]
+        if path.count(func) >= limit:
+            return 0, []
+    if func not in stack:
+        unresolved.add(func)
+    path.append(func)
+    best = (0, [])
+    for callee in sorted(edges.get(func, ())):
+        candidate = worst_path(callee, stack, edges, cyclic, unresolved, unbounded, memo, path)
+        if candidate[0] > best[0]:
+            best = candidate
+    path.pop()
+    result = (stack.get(func, 0) + best[0], [func] + best[1])
+    if func not in cyclic:
+        memo[func] = result
+    return result
+
+
+def static_ram(nm, elf, top):
+    """Sums .data/.bss symbol sizes with nm and returns (total, largest symbols)."""
+    out = subprocess.run([nm, "-S", "--size-sort", "-t", "d", elf],
+                         check=True, capture_output=True, text=True).stdout
+    symbols = []
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) == 4 and parts[2] in ("b", "B", "d", "D"):
+            symbols.append((int(parts[1]), parts[3]))
+    symbols.sort(reverse=True)
+    return sum(size for size, _ in symbols), symbols[:top]
+
+
+def short_name(title):
+    """Static functions are titled "file:function"; keep the function name."""
+    return title.rsplit(":", 1)[-1]
+
+
+def find_node(name, stack):
+    """Returns the node title of a function, global or file-static."""
+    if name in stack:
+        return name
+    for title in stack:
+        if short_name(title) == name:
+            return title
+    return None
+
+
+def report_roots(title, roots, stack, kinds, edges, cyclic, unresolved, unbounded, memo):
+    worst = 0
+    print(title)
+    for root in roots:
+        node = find_node(root, stack)
+        if node is None:
+            print(f"  {root}: no call-graph information")
+            continue
+        depth, chain = worst_path(node, stack, edges, cyclic, unresolved, unbounded, memo, [])
+        dynamic = [short_name(f) for f in chain if kinds.get(f, "static") != "static"]
+        print(f"  {root}: {depth} bytes")
+        print("    " + " -> ".join(short_name(f) for f in chain))
+        if dynamic:
+            print("    dynamic frames: " + ", ".join(dynamic))
+        worst = max(worst, depth)
+    return worst
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--ci-dir", required=True, help="directory holding the .ci files")
+    parser.add_argument("--elf", required=True, help="linked firmware image")
+    parser.add_argument("--nm", default="arm-none-eabi-nm", help="nm executable for the target")
+    parser.add_argument("--core0-stack", type=int, default=0x800, help="Core0 stack size in bytes")
+    parser.add_argument("--core1-stack", type=int, default=0x800, help="Core1 stack size in bytes")
+    parser.add_argument("--top", type=int, default=10, help="number of static objects to list")
+    args = parser.parse_args()
+
+    stack, kinds, edges = load_callgraph(args.ci_dir)
+    if not stack:
+        print("memory report: no .ci files found (is -fcallgraph-info supported?)")
+        return 0
+
+    total, largest = static_ram(args.nm, args.elf, args.top)
+    print("== Static RAM (.data + .bss) ==")
+    print(f"  total: {total} bytes")
+    for size, name in largest:
+        print(f"  {size:8d}  {name}")
+
+    cyclic = cyclic_nodes(edges)
+    unresolved = set()
+    unbounded = set()
+    memo = {}
+    graph = (stack, kinds, edges, cyclic, unresolved, unbounded, memo)
+    print("== Worst-case stack ==")
+    core0 = report_roots("Core0", CORE0_ROOTS, *graph)
+    irq = report_roots("Core0 interrupts", CORE0_IRQ_ROOTS, *graph)
+    core1 = report_roots("Core1", CORE1_ROOTS, *graph)
+
+    print(f"  Core0 total (thread + deepest interrupt): {core0 + irq} of {args.core0_stack} bytes")
+    print(f"  Core1 total: {core1} of {args.core1_stack} bytes")
+    if unresolved:
+        print("  not analysed (counted as 0): " + ", ".join(sorted(short_name(f) for f in unresolved)))
+    if unbounded:
+        print("  unbounded recursion: " + ", ".join(sorted(short_name(f) for f in unbounded)))
+
+    if core0 + irq > args.core0_stack or core1 > args.core1_stack:
+        print("memory report: WARNING: worst-case stack exceeds the reserved size")
+    if unbounded:
+        print("memory report: WARNING: recursion without a nesting limit, the stack cannot be bounded")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
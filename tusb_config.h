@@ -0,0 +1,60 @@
+/**
+ * @file tusb_config.h
+ * @brief TinyUSB device configuration for the PicoSWITool.
+ *
+ * The firmware drives TinyUSB directly instead of going through pico_stdio_usb,
+ * so that Core0 can pull command bytes from the CDC FIFO in bulk.
+ *
+ * Author: jjsch-dev
+ */
+
+#ifndef _TUSB_CONFIG_H_
+#define _TUSB_CONFIG_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// RHPort 0 runs as a full-speed device.
+#ifndef CFG_TUSB_RHPORT0_MODE
+#define CFG_TUSB_RHPORT0_MODE       (OPT_MODE_DEVICE)
+#endif
+
+#ifndef CFG_TUSB_OS
+#define CFG_TUSB_OS                 OPT_OS_PICO
+#endif
+
+#ifndef CFG_TUSB_MEM_SECTION
+#define CFG_TUSB_MEM_SECTION
+#endif
+
+#ifndef CFG_TUSB_MEM_ALIGN
+#define CFG_TUSB_MEM_ALIGN          __attribute__ ((aligned(4)))
+#endif
+
+#define CFG_TUD_ENDPOINT0_SIZE      64
+
+// Device classes.
+#define CFG_TUD_CDC                 2   // Console + event channel
+#define CFG_TUD_MSC                 0
+#define CFG_TUD_HID                 0
+#define CFG_TUD_MIDI                0
+#define CFG_TUD_VENDOR              1
+
+// CDC FIFO sizes, per interface. The console RX FIFO is drained in bulk into the
+// command ring buffer.
+#define CFG_TUD_CDC_RX_BUFSIZE      256
+#define CFG_TUD_CDC_TX_BUFSIZE      256
+#define CFG_TUD_CDC_EP_BUFSIZE      64
+
+// Vendor bulk interface carrying the binary protocol. The TX FIFO must hold a
+// complete response frame (BIN_HDR_RESP + BIN_MAX_PAYLOAD in swi_tool.c).
+#define CFG_TUD_VENDOR_RX_BUFSIZE   512
+#define CFG_TUD_VENDOR_TX_BUFSIZE   512
+#define CFG_TUD_VENDOR_EPSIZE       64
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TUSB_CONFIG_H_ */
@@ -0,0 +1,148 @@
+/**
+ * @file usb_descriptors.c
+ * @brief USB device, configuration and string descriptors for the PicoSWITool.
+ *
+ * Composite device:
+ * - a CDC-ACM interface carrying the JSON command console, for humans and terminals;
+ * - a second CDC-ACM interface reserved for asynchronous traces and events;
+ * - a vendor-specific bulk IN/OUT interface carrying the binary protocol, for
+ *   high-rate host tooling (libusb, pyusb) without the tty layer in the way.
+ * The VID/PID pair matches the one used by pico_stdio_usb, so hosts keep
+ * enumerating the console as a regular Pico serial port.
+ *
+ * Author: jjsch-dev
+ */
+
+#include <string.h>
+#include "tusb.h"
+#include "pico/unique_id.h"
+
+#define USBD_VID            0x2E8A  ///< Raspberry Pi
+#define USBD_PID            0x000A  ///< Raspberry Pi Pico SDK CDC
+#define USBD_MAX_POWER_MA   100
+
+// Interface numbers.
+enum {
+    ITF_NUM_CDC = 0,
+    ITF_NUM_CDC_DATA,
+    ITF_NUM_CDC_EVT,
+    ITF_NUM_CDC_EVT_DATA,
+    ITF_NUM_VENDOR,
+    ITF_NUM_TOTAL
+};
+
+// Endpoint addresses.
+#define EPNUM_CDC_NOTIF     0x81
+#define EPNUM_CDC_OUT       0x02
+#define EPNUM_CDC_IN        0x82
+#define EPNUM_VENDOR_OUT    0x03
+#define EPNUM_VENDOR_IN     0x83
+#define EPNUM_CDC_EVT_NOTIF 0x84
+#define EPNUM_CDC_EVT_OUT   0x05
+#define EPNUM_CDC_EVT_IN    0x85
+
+#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + 2 * TUD_CDC_DESC_LEN + TUD_VENDOR_DESC_LEN)
+
+// String descriptor indexes.
+enum {
+    STRID_LANGID = 0,
+    STRID_MANUFACTURER,
+    STRID_PRODUCT,
+    STRID_SERIAL,
+    STRID_CDC,
+    STRID_VENDOR,
+    STRID_CDC_EVT,
+};
+
+static const tusb_desc_device_t desc_device = {
+    .bLength            = sizeof(tusb_desc_device_t),
+    .bDescriptorType    = TUSB_DESC_DEVICE,
+    .bcdUSB             = 0x0200,
+    // IAD is required because each CDC function uses two interfaces.
+    .bDeviceClass       = TUSB_CLASS_MISC,
+    .bDeviceSubClass    = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol    = MISC_PROTOCOL_IAD,
+    .bMaxPacketSize0    = CFG_TUD_ENDPOINT0_SIZE,
+    .idVendor           = USBD_VID,
+    .idProduct          = USBD_PID,
+    .bcdDevice          = 0x0102,  // Bumped when the interface layout changes.
+    .iManufacturer      = STRID_MANUFACTURER,
+    .iProduct           = STRID_PRODUCT,
+    .iSerialNumber      = STRID_SERIAL,
+    .bNumConfigurations = 1
+};
+
+static const uint8_t desc_configuration[] = {
+    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, USBD_MAX_POWER_MA),
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, STRID_CDC, EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, EPNUM_CDC_IN,
+                       CFG_TUD_CDC_EP_BUFSIZE),
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_EVT, STRID_CDC_EVT, EPNUM_CDC_EVT_NOTIF, 8, EPNUM_CDC_EVT_OUT,
+                       EPNUM_CDC_EVT_IN, CFG_TUD_CDC_EP_BUFSIZE),
+    TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR, STRID_VENDOR, EPNUM_VENDOR_OUT, EPNUM_VENDOR_IN,
+                          CFG_TUD_VENDOR_EPSIZE),
+};
+
+static const char *const string_desc_arr[] = {
+    [STRID_MANUFACTURER] = "jjsch-dev",
+    [STRID_PRODUCT]      = "PicoSWITool",
+    [STRID_SERIAL]       = NULL,  // Filled from the flash unique ID.
+    [STRID_CDC]          = "PicoSWITool Console",
+    [STRID_VENDOR]       = "PicoSWITool Binary",
+    [STRID_CDC_EVT]      = "PicoSWITool Events",
+};
+
+/**
+ * @brief Invoked on GET DEVICE DESCRIPTOR.
+ */
+const uint8_t *tud_descriptor_device_cb(void) {
+    return (const uint8_t *)&desc_device;
+}
+
+/**
+ * @brief Invoked on GET CONFIGURATION DESCRIPTOR.
+ */
+const uint8_t *tud_descriptor_configuration_cb(uint8_t index) {
+    (void)index;
+    return desc_configuration;
+}
+
+/**
+ * @brief Invoked on GET STRING DESCRIPTOR.
+ *
+ * Converts the ASCII strings to UTF-16LE on the fly. The serial number
+ * is taken from the board unique ID.
+ */
+const uint16_t *tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
+    static uint16_t desc_str[33];
+    char serial[2 * 8 + 1];
+    const char *str;
+    uint8_t len;
+
+    (void)langid;
+
+    if (index == STRID_LANGID) {
+        desc_str[1] = 0x0409;  // English (US)
+        len = 1;
+    } else {
+        if (index >= TU_ARRAY_SIZE(string_desc_arr)) {
+            return NULL;
+        }
+        if (index == STRID_SERIAL) {
+            pico_get_unique_board_id_string(serial, sizeof(serial));
+            str = serial;
+        } else {
+            str = string_desc_arr[index];
+        }
+        len = (uint8_t)strlen(str);
+        if (len > 32) {
+            len = 32;
+        }
+        for (uint8_t i = 0; i < len; i++) {
+            desc_str[1 + i] = str[i];
+        }
+    }
+
+    // First element: length (including header) and descriptor type.
+    desc_str[0] = (uint16_t)((TUSB_DESC_STRING << 8) | (2 * len + 2));
+    return desc_str;
+}